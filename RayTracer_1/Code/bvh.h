@@ -0,0 +1,114 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include "aabb.h"
+#include "ray.h"
+#include "triple.h"
+
+#include <vector>
+
+// Bounding volume hierarchy over a set of boxes, built with the surface
+// area heuristic (SAH). The tree only stores indices into the list of boxes
+// it was built from; interpreting those is left to the caller.
+class BVH
+{
+    struct Node
+    {
+        AABB box;
+        unsigned offset;    // leaf: first index, inner: index of right child
+        unsigned count;     // number of indices in a leaf, 0 for inner nodes
+    };
+
+    std::vector<Node> d_nodes;
+    std::vector<unsigned> d_indices;
+
+    public:
+        // (Re)build the tree. Leaves will hold at most maxLeafSize boxes.
+        void build(std::vector<AABB> const &boxes, unsigned maxLeafSize = 4);
+
+        bool empty() const;
+        unsigned numNodes() const;
+
+        // Visit the boxes the ray may hit within [ray.tMin, ray.tMax],
+        // roughly front to back. visit(index) is called with the index of the
+        // box and may lower ray.tMax (e.g. after finding a closer hit). If
+        // visit returns true the traversal stops and true is returned.
+        template <typename Visitor>
+        bool traverse(Ray &ray, Visitor visit) const;
+
+    private:
+        void buildNode(std::vector<AABB> const &boxes,
+                       std::vector<Point> const &centroids,
+                       unsigned first, unsigned last,
+                       unsigned maxLeafSize, unsigned depth);
+};
+
+template <typename Visitor>
+bool BVH::traverse(Ray &ray, Visitor visit) const
+{
+    if (d_nodes.empty())
+        return false;
+
+    Vector invD(1.0 / ray.D.x, 1.0 / ray.D.y, 1.0 / ray.D.z);
+
+    double tEntry;
+    if (not d_nodes[0].box.intersect(ray, invD, tEntry))
+        return false;
+
+    // Depth of a SAH tree is bounded in practice; 64 levels suffice.
+    unsigned stack[64];
+    unsigned top = 0;
+    unsigned current = 0;
+
+    while (true)
+    {
+        Node const &node = d_nodes[current];
+        if (node.count > 0)
+        {
+            for (unsigned idx = node.offset; idx != node.offset + node.count; ++idx)
+                if (visit(d_indices[idx]))
+                    return true;
+        }
+        else
+        {
+            unsigned left = current + 1;
+            unsigned right = node.offset;
+            double tLeft;
+            double tRight;
+            bool hitLeft = d_nodes[left].box.intersect(ray, invD, tLeft);
+            bool hitRight = d_nodes[right].box.intersect(ray, invD, tRight);
+
+            if (hitLeft and hitRight)
+            {
+                // Descend into the nearest child first, postpone the other.
+                if (tRight < tLeft)
+                    std::swap(left, right);
+                stack[top++] = right;
+                current = left;
+                continue;
+            }
+            if (hitLeft)
+            {
+                current = left;
+                continue;
+            }
+            if (hitRight)
+            {
+                current = right;
+                continue;
+            }
+        }
+
+        // Pop the next postponed node that is still within reach.
+        while (true)
+        {
+            if (top == 0)
+                return false;
+            current = stack[--top];
+            if (d_nodes[current].box.intersect(ray, invD, tEntry))
+                break;
+        }
+    }
+}
+
+#endif
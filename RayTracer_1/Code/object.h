@@ -19,8 +19,11 @@ class Object
 
         virtual ~Object() = default;
 
-        virtual Hit intersect(Ray const &ray) = 0;  // must be implemented
-                                                    // in derived class
+        // Implementations must not modify the object, so a scene can be
+        // shared between threads. Only hits within [ray.tMin, ray.tMax] may
+        // be returned; reject candidates outside of it as early as possible.
+        virtual Hit intersect(Ray const &ray) const = 0;    // must be implemented
+                                                            // in derived class
 };
 
 #endif
@@ -10,18 +10,20 @@
 
 using namespace std;
 
-Color Scene::trace(Ray const &ray)
+Color Scene::trace(Ray const &ray) const
 {
     // Find hit object and distance
     Hit min_hit(numeric_limits<double>::infinity(), Vector());
     ObjectPtr obj = nullptr;
+    Ray closest(ray);   // interval shrinks to the closest hit so far
     for (unsigned idx = 0; idx != objects.size(); ++idx)
     {
-        Hit hit(objects[idx]->intersect(ray));
+        Hit hit(objects[idx]->intersect(closest));
         if (hit.t < min_hit.t)
         {
             min_hit = hit;
             obj = objects[idx];
+            closest.tMax = hit.t;
         }
     }
 
@@ -112,12 +114,12 @@ void Scene::setEye(Triple const &position)
     eye = position;
 }
 
-unsigned Scene::getNumObject()
+unsigned Scene::getNumObject() const
 {
     return objects.size();
 }
 
-unsigned Scene::getNumLights()
+unsigned Scene::getNumLights() const
 {
     return lights.size();
 }
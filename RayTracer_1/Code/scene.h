@@ -20,7 +20,7 @@ class Scene
     public:
 
         // trace a ray into the scene and return the color
-        Color trace(Ray const &ray);
+        Color trace(Ray const &ray) const;
 
         // render the scene to the given image
         void render(Image &img);
@@ -30,8 +30,8 @@ class Scene
         void addLight(Light const &light);
         void setEye(Triple const &position);
 
-        unsigned getNumObject();
-        unsigned getNumLights();
+        unsigned getNumObject() const;
+        unsigned getNumLights() const;
 };
 
 #endif
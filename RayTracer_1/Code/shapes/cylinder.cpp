@@ -4,7 +4,7 @@
 
 using namespace std;
 
-Hit Cylinder::intersect(Ray const &ray)
+Hit Cylinder::intersect(Ray const &ray) const
 {
   Vector OC = (ray.O - position);
 
@@ -33,21 +33,23 @@ Hit Cylinder::intersect(Ray const &ray)
   double z1 = OC.z + t1 * ray.D.z;
   double z2 = OC.z + t2 * ray.D.z;
 
+  // A root counts if it lies within the ray's interval and the height range
+  bool valid1 = z_min < z1 && z1 < z_max && ray.inRange(t1);
+  bool valid2 = z_min < z2 && z2 < z_max && ray.inRange(t2);
+
   // Compute t
-  double t = 0;
-
-  if(z_min < z1 && z1 < z_max && t1 > 0) {
-    if(z_min < z2 && z2 < z_max && t2 > 0) {
-      t = fmin(t1, t2);
-    } else {
-      t = t1;
-    }
-  } else if(z_min < z2 && z2 < z_max && t2 < 0) {
+  double t;
+
+  if(valid1 && valid2) {
+    t = fmin(t1, t2);
+  } else if(valid1) {
+    t = t1;
+  } else if(valid2) {
     t = t2;
+  } else {
+    return Hit::NO_HIT();
   }
 
-  if(t==0) return Hit::NO_HIT();
-
   Point intersection = ray.at(t);
   Vector N  = (intersection - position).normalized();
   // Normal: directed towards ray origin
@@ -12,7 +12,7 @@ class Cylinder: public Object
     public:
         Cylinder(Point const &pos, Vector const &direction, double radius);
 
-        virtual Hit intersect(Ray const &ray);
+        virtual Hit intersect(Ray const &ray) const;
 };
 
 #endif
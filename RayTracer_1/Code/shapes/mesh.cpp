@@ -2,7 +2,6 @@
 
 #include "../objloader.h"
 #include "../vertex.h"
-#include "triangle.h"
 
 #include <cmath>
 #include <iostream>
@@ -10,23 +9,26 @@
 
 using namespace std;
 
-Hit Mesh::intersect(Ray const &ray)
+Hit Mesh::intersect(Ray const &ray) const
 {
-    // Replace the return of a NO_HIT by determining the intersection based
-    // on the ray and this class's data members.
+    // Only triangles in BVH nodes entered before the closest hit so far are
+    // tested. A ray missing the mesh costs a single box test.
     Hit min_hit(numeric_limits<double>::infinity(), Vector());
-    ObjectPtr obj = nullptr;
-    for (unsigned idx = 0; idx != d_tris.size(); ++idx) {
-        Hit hit(d_tris[idx]->intersect(ray));
+    Ray closest(ray);   // interval shrinks to the closest hit so far
+    d_bvh.traverse(closest, [&](unsigned idx)
+    {
+        // Qualified call: the type is known, skip the virtual dispatch.
+        Hit hit(d_tris[idx].Triangle::intersect(closest));
         if (hit.t < min_hit.t)
         {
             min_hit = hit;
-            obj = d_tris[idx];
+            closest.tMax = hit.t;
         }
-    }
+        return false;
+    });
 
     // No hit? Return background color.
-    if (!obj) return Hit::NO_HIT();
+    if (std::isinf(min_hit.t)) return Hit::NO_HIT();
     return Hit(min_hit);
 }
 
@@ -82,9 +84,15 @@ Mesh::Mesh(string const &filename, Point const &position, Vector const &rotation
         v1 = (v1 + position);
         v2 = (v2 + position);
 
-        d_tris.push_back(ObjectPtr(new Triangle(v0, v1, v2)));
+        d_tris.push_back(Triangle(v0, v1, v2));
     }
 
+    vector<AABB> boxes;
+    boxes.reserve(d_tris.size());
+    for (Triangle const &tri : d_tris)
+        boxes.push_back(tri.boundingBox());
+    d_bvh.build(boxes);
+
     cout << "Loaded model: " << filename << " with " <<
         model.numTriangles() << " triangles.\n";
 }
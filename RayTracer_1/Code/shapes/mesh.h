@@ -1,14 +1,17 @@
 #ifndef MESH_H_
 #define MESH_H_
 
+#include "../bvh.h"
 #include "../object.h"
+#include "triangle.h"
 
 #include <string>
 #include <vector>
 
 class Mesh: public Object
 {
-    std::vector<ObjectPtr> d_tris;
+    std::vector<Triangle> d_tris;
+    BVH d_bvh;                      // over d_tris, built by the constructor
 
     public:
         Mesh(std::string const &filename,
@@ -16,7 +19,7 @@ class Mesh: public Object
              Vector const &rotation,
              Vector const &scale);
 
-        virtual Hit intersect(Ray const &ray);
+        virtual Hit intersect(Ray const &ray) const;
 };
 
 #endif
@@ -5,18 +5,20 @@
 
 using namespace std;
 
-Hit Quad::intersect(Ray const &ray)
+Hit Quad::intersect(Ray const &ray) const
 {
   // Replace the return of a NO_HIT by determining the intersection based
   // on the ray and this class's data members.
   Hit min_hit(numeric_limits<double>::infinity(), Vector());
   ObjectPtr obj = nullptr;
+  Ray closest(ray);   // interval shrinks to the closest hit so far
   for (unsigned idx = 0; idx != quad_triangles.size(); ++idx) {
-      Hit hit(quad_triangles[idx]->intersect(ray));
+      Hit hit(quad_triangles[idx]->intersect(closest));
       if (hit.t < min_hit.t)
       {
           min_hit = hit;
           obj = quad_triangles[idx];
+          closest.tMax = hit.t;
       }
   }
 
@@ -13,7 +13,7 @@ class Quad: public Object
              Point const &v2,
              Point const &v3);
 
-        virtual Hit intersect(Ray const &ray);
+        virtual Hit intersect(Ray const &ray) const;
 };
 
 #endif
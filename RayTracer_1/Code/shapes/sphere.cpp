@@ -4,7 +4,7 @@
 
 using namespace std;
 
-Hit Sphere::intersect(Ray const &ray)
+Hit Sphere::intersect(Ray const &ray) const
 {
     /****************************************************
     * RT1.1: INTERSECTION CALCULATION
@@ -51,14 +51,12 @@ Hit Sphere::intersect(Ray const &ray)
     t1 = (-b + sqrt(discr)) / (2*a);
     t2 = (-b - sqrt(discr)) / (2*a);
 
-    // Interection occurs when the solution is positive
-    // In case of two solutions, we take the least positive one
-    if (t1 >= 0 && t2 >= 0) {
+    // Interection occurs when the solution lies within the ray's interval
+    // In case of two solutions, we take the least one within it
+    if (ray.inRange(fmin(t1,t2))) {
         t = fmin(t1,t2);
-    } else if (t1 < 0 && t2 >= 0) {
-        t = t2;
-    } else if (t2 < 0 && t1 >= 0) {
-        t = t1;
+    } else if (ray.inRange(fmax(t1,t2))) {
+        t = fmax(t1,t2);
     } else {
         return Hit::NO_HIT();
     }
@@ -8,7 +8,7 @@ class Sphere: public Object
     public:
         Sphere(Point const &pos, double radius);
 
-        virtual Hit intersect(Ray const &ray);
+        virtual Hit intersect(Ray const &ray) const;
 
         Point const position;
         double const r;
@@ -2,7 +2,7 @@
 
 #include <cmath>
 
-Hit Triangle::intersect(Ray const &ray)
+Hit Triangle::intersect(Ray const &ray) const
 {
   // dot product between N and ray's direction
   double dotProdND = N.dot(ray.D);
@@ -17,10 +17,10 @@ Hit Triangle::intersect(Ray const &ray)
   double D = N.dot(v1);
   // substitute P = ray.O + t * ray.D in plane equation above
   // compute t
-  double t =  (N.dot(ray.O) - D) / N.dot(ray.D);
+  double t =  (D - N.dot(ray.O)) / N.dot(ray.D);
 
-  // triangle behind the ray (no hit)
-  if(t < 0) return Hit::NO_HIT();
+  // triangle outside of the ray's interval, e.g. behind it (no hit)
+  if(!ray.inRange(t)) return Hit::NO_HIT();
 
   // compute P
   Vector P = ray.O + t * ray.D;
@@ -42,10 +42,18 @@ Hit Triangle::intersect(Ray const &ray)
   F = z_edge.cross(v1p);
   if(N.dot(F) < 0) return Hit::NO_HIT();
 
-  // direct the normal towards ray's origin
-  N = (N.dot(ray.D) < 0) ? N : -N;
+  // direct the normal towards ray's origin, in the hit record only: the
+  // triangle itself is shared between rays (and threads)
+  return Hit(t, (N.dot(ray.D) < 0) ? N : -N);
+}
 
-  return Hit(t, N);
+AABB Triangle::boundingBox() const
+{
+  AABB box;
+  box.extend(v0);
+  box.extend(v1);
+  box.extend(v2);
+  return box;
 }
 
 Triangle::Triangle(Point const &v0,
@@ -55,14 +63,9 @@ Triangle::Triangle(Point const &v0,
     v0(v0),
     v1(v1),
     v2(v2),
-    N(),
-    x_edge(),
-    y_edge(),
-    z_edge()
-{
-  x_edge = v1-v0; // edge along x-axis
-  y_edge = v0-v2; // edge along y-axis
-  z_edge = v2-v1; // edge along z-axis
-  // normalized normal vector: parallel to z-axis
-  N = ((v1-v0).cross(v2-v0)).normalized();
-}
+    // normalized normal vector: parallel to z-axis
+    N(((v1-v0).cross(v2-v0)).normalized()),
+    x_edge(v1-v0),  // edge along x-axis
+    y_edge(v0-v2),  // edge along y-axis
+    z_edge(v2-v1)   // edge along z-axis
+{}
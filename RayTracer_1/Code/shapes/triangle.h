@@ -1,6 +1,7 @@
 #ifndef TRIANGLE_H_
 #define TRIANGLE_H_
 
+#include "../aabb.h"
 #include "../object.h"
 
 class Triangle: public Object
@@ -10,15 +11,17 @@ class Triangle: public Object
                  Point const &v1,
                  Point const &v2);
 
-        virtual Hit intersect(Ray const &ray);
+        virtual Hit intersect(Ray const &ray) const;
 
-        Point v0;
-        Point v1;
-        Point v2;
-        Vector N;
-        Vector x_edge;
-        Vector y_edge;
-        Vector z_edge;
+        AABB boundingBox() const;
+
+        Point const v0;
+        Point const v1;
+        Point const v2;
+        Vector const N;         // as given by the winding, never flipped
+        Vector const x_edge;
+        Vector const y_edge;
+        Vector const z_edge;
 };
 
 #endif
@@ -0,0 +1,153 @@
+
+#ifndef AABB_H_
+#define AABB_H_
+
+#include "packet.h"
+#include "ray.h"
+#include "simd.h"
+#include "triple.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Axis aligned bounding box. A default constructed box is empty and can be
+// grown with extend().
+class AABB
+{
+    public:
+        Point min;
+        Point max;
+
+        AABB()
+        :
+            min(std::numeric_limits<double>::infinity(),
+                std::numeric_limits<double>::infinity(),
+                std::numeric_limits<double>::infinity()),
+            max(-std::numeric_limits<double>::infinity(),
+                -std::numeric_limits<double>::infinity(),
+                -std::numeric_limits<double>::infinity())
+        {}
+
+        AABB(Point const &min, Point const &max)
+        :
+            min(min),
+            max(max)
+        {}
+
+        void extend(Point const &p)
+        {
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                min.data[axis] = std::min(min.data[axis], p.data[axis]);
+                max.data[axis] = std::max(max.data[axis], p.data[axis]);
+            }
+        }
+
+        void extend(AABB const &box)
+        {
+            extend(box.min);
+            extend(box.max);
+        }
+
+        bool empty() const
+        {
+            return min.x > max.x;
+        }
+
+        Point centroid() const
+        {
+            return 0.5 * (min + max);
+        }
+
+        double surfaceArea() const
+        {
+            if (empty())
+                return 0.0;
+            Vector d = max - min;
+            return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+
+        unsigned longestAxis() const
+        {
+            Vector d = max - min;
+            if (d.x >= d.y and d.x >= d.z)
+                return 0;
+            return d.y >= d.z ? 1 : 2;
+        }
+
+        // Slab test against the interval of the ray. invD holds the
+        // reciprocal of the ray direction. On a hit tEntry is set to the
+        // distance at which the ray enters the box.
+        bool intersect(Ray const &ray, Vector const &invD, double &tEntry) const
+        {
+            double t0 = ray.tMin;
+            double t1 = ray.tMax;
+            for (unsigned axis = 0; axis != 3; ++axis)
+            {
+                double tNear = (min.data[axis] - ray.O.data[axis]) * invD.data[axis];
+                double tFar  = (max.data[axis] - ray.O.data[axis]) * invD.data[axis];
+                if (tNear > tFar)
+                    std::swap(tNear, tFar);
+
+                // Widen the far side a little so rounding errors never
+                // cull a primitive lying exactly on the box boundary.
+                // fmax/fmin discard the NaNs produced by 0 * inf.
+                tFar *= 1.0 + 4.0 * std::numeric_limits<double>::epsilon();
+                t0 = std::fmax(t0, tNear);
+                t1 = std::fmin(t1, tFar);
+                if (t0 > t1)
+                    return false;
+            }
+            tEntry = t0;
+            return true;
+        }
+
+        // The same test for every ray of a packet. Returns whether any of
+        // them hits the box, tEntry is set to the nearest of their entry
+        // distances.
+        bool intersect(RayPacket const &packet, double &tEntry) const
+        {
+            using namespace simd;
+
+            Lanes const widen =
+                broadcast(1.0 + 4.0 * std::numeric_limits<double>::epsilon());
+            double const *origins[3] = {packet.ox, packet.oy, packet.oz};
+            double const *invDs[3] = {packet.invDx, packet.invDy, packet.invDz};
+
+            double entry[RayPacket::MAX_SIZE];
+            unsigned hits = 0;
+            for (unsigned chunk = 0; chunk != packet.numChunks(); ++chunk)
+            {
+                unsigned base = chunk * WIDTH;
+                Lanes t0 = load(packet.tMin + base);
+                Lanes t1 = load(packet.tMax + base);
+                for (unsigned axis = 0; axis != 3; ++axis)
+                {
+                    Lanes O = load(origins[axis] + base);
+                    Lanes invD = load(invDs[axis] + base);
+                    Lanes tNear = (broadcast(min.data[axis]) - O) * invD;
+                    Lanes tFar  = (broadcast(max.data[axis]) - O) * invD;
+                    Mask swap = tNear > tFar;
+                    Lanes lo = select(swap, tFar, tNear);
+                    Lanes hi = select(swap, tNear, tFar);
+
+                    t0 = simd::fmax(t0, lo);
+                    t1 = simd::fmin(t1, hi * widen);
+                }
+                hits |= bits(!(t0 > t1)) << base;
+                store(entry + base, t0);
+            }
+
+            if (hits == 0)
+                return false;
+
+            tEntry = std::numeric_limits<double>::infinity();
+            for (unsigned lane = 0; hits != 0; ++lane, hits >>= 1)
+                if (hits & 1)
+                    tEntry = std::min(tEntry, entry[lane]);
+            return true;
+        }
+};
+
+#endif
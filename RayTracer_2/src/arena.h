@@ -0,0 +1,63 @@
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "object.h"
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Owns the objects of a scene. Objects are placed next to each other in
+// large blocks instead of being allocated one by one, and are referred to
+// by plain pointers, which stay valid until the arena is destroyed.
+class ObjectArena
+{
+    static size_t const BLOCK_SIZE = 1 << 16;
+
+    std::vector<std::unique_ptr<unsigned char[]>> d_blocks;
+    size_t d_used = BLOCK_SIZE;     // bytes used in the last block
+    std::vector<Object *> d_objects;
+
+    public:
+        ObjectArena() = default;
+        ObjectArena(ObjectArena const &) = delete;
+        ObjectArena &operator=(ObjectArena const &) = delete;
+
+        ~ObjectArena()
+        {
+            for (auto obj = d_objects.rbegin(); obj != d_objects.rend(); ++obj)
+                (*obj)->~Object();
+        }
+
+        // Construct a Shape from args inside the arena
+        template <typename Shape, typename... Args>
+        Shape *create(Args &&...args)
+        {
+            void *memory = allocate(sizeof(Shape), alignof(Shape));
+            Shape *obj = new (memory) Shape(std::forward<Args>(args)...);
+            d_objects.push_back(obj);
+            return obj;
+        }
+
+    private:
+        void *allocate(size_t size, size_t alignment)
+        {
+            size_t offset = (d_used + alignment - 1) / alignment * alignment;
+            if (offset + size > BLOCK_SIZE)
+            {
+                // Start a new block (oversized objects get one of their own).
+                // new[] aligns for any fundamental type.
+                size_t blockSize = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+                d_blocks.push_back(std::unique_ptr<unsigned char[]>(
+                                        new unsigned char[blockSize]));
+                offset = 0;
+            }
+            d_used = offset + size;
+            return d_blocks.back().get() + offset;
+        }
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+namespace
+{
+    // Number of bins used to evaluate the SAH along an axis.
+    unsigned const NUM_BINS = 16;
+
+    // Relative cost of a traversal step compared to a primitive test.
+    double const TRAVERSAL_COST = 1.0;
+
+    // Beyond this depth nodes are split at the median, which bounds the
+    // depth of the tree (and with it the traversal stack).
+    unsigned const MAX_SAH_DEPTH = 40;
+
+    struct Bin
+    {
+        AABB box;
+        unsigned count = 0;
+    };
+}
+
+void BVH::build(vector<AABB> const &boxes, unsigned maxLeafSize)
+{
+    d_nodes.clear();
+    d_indices.resize(boxes.size());
+    if (boxes.empty())
+        return;
+
+    vector<Point> centroids;
+    centroids.reserve(boxes.size());
+    for (unsigned idx = 0; idx != boxes.size(); ++idx)
+    {
+        d_indices[idx] = idx;
+        centroids.push_back(boxes[idx].centroid());
+    }
+
+    // A binary tree with leaves of at least one box has < 2N nodes.
+    d_nodes.reserve(2 * boxes.size());
+    d_nodes.push_back(Node());
+    buildNode(boxes, centroids, 0, boxes.size(), maxLeafSize, 0);
+}
+
+bool BVH::empty() const
+{
+    return d_nodes.empty();
+}
+
+unsigned BVH::numNodes() const
+{
+    return d_nodes.size();
+}
+
+vector<unsigned> const &BVH::order() const
+{
+    return d_indices;
+}
+
+// Builds the node at the back of d_nodes over d_indices[first, last).
+void BVH::buildNode(vector<AABB> const &boxes,
+                    vector<Point> const &centroids,
+                    unsigned first, unsigned last,
+                    unsigned maxLeafSize, unsigned depth)
+{
+    unsigned nodeIdx = d_nodes.size() - 1;
+    unsigned count = last - first;
+
+    AABB box;
+    AABB centroidBox;
+    for (unsigned idx = first; idx != last; ++idx)
+    {
+        box.extend(boxes[d_indices[idx]]);
+        centroidBox.extend(centroids[d_indices[idx]]);
+    }
+    d_nodes[nodeIdx].box = box;
+
+    // Make a leaf of the node: store the range of indices.
+    auto makeLeaf = [&]()
+    {
+        d_nodes[nodeIdx].offset = first;
+        d_nodes[nodeIdx].count = count;
+    };
+
+    unsigned axis = centroidBox.longestAxis();
+    double cmin = centroidBox.min.data[axis];
+    double cmax = centroidBox.max.data[axis];
+
+    // All centroids coincide: there is nothing to split on.
+    if (count <= 1 or cmin == cmax)
+    {
+        makeLeaf();
+        return;
+    }
+
+    unsigned mid;
+    if (depth < MAX_SAH_DEPTH)
+    {
+        // Bin the centroids along the longest axis.
+        Bin bins[NUM_BINS];
+        double scale = NUM_BINS / (cmax - cmin);
+        auto binOf = [&](unsigned idx)
+        {
+            unsigned bin = static_cast<unsigned>((centroids[idx].data[axis] - cmin) * scale);
+            return min(bin, NUM_BINS - 1);
+        };
+        for (unsigned idx = first; idx != last; ++idx)
+        {
+            Bin &bin = bins[binOf(d_indices[idx])];
+            bin.box.extend(boxes[d_indices[idx]]);
+            ++bin.count;
+        }
+
+        // Sweep from the right to collect the area/count of all suffixes,
+        // then from the left to evaluate each of the NUM_BINS - 1 splits.
+        double rightArea[NUM_BINS];
+        unsigned rightCount[NUM_BINS];
+        AABB acc;
+        unsigned accCount = 0;
+        for (unsigned bin = NUM_BINS - 1; bin != 0; --bin)
+        {
+            acc.extend(bins[bin].box);
+            accCount += bins[bin].count;
+            rightArea[bin] = acc.surfaceArea();
+            rightCount[bin] = accCount;
+        }
+
+        double bestCost = numeric_limits<double>::infinity();
+        unsigned bestSplit = 0;
+        acc = AABB();
+        accCount = 0;
+        for (unsigned bin = 0; bin != NUM_BINS - 1; ++bin)
+        {
+            acc.extend(bins[bin].box);
+            accCount += bins[bin].count;
+            double cost = accCount * acc.surfaceArea()
+                        + rightCount[bin + 1] * rightArea[bin + 1];
+            if (accCount != 0 and rightCount[bin + 1] != 0 and cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = bin;
+            }
+        }
+
+        // Compare against not splitting at all (costs relative to parent area).
+        double leafCost = count;
+        double splitCost = TRAVERSAL_COST + bestCost / box.surfaceArea();
+        if (count <= maxLeafSize and leafCost <= splitCost)
+        {
+            makeLeaf();
+            return;
+        }
+
+        auto middle = partition(d_indices.begin() + first, d_indices.begin() + last,
+                                [&](unsigned idx) { return binOf(idx) <= bestSplit; });
+        mid = middle - d_indices.begin();
+    }
+    else
+    {
+        if (count <= maxLeafSize)
+        {
+            makeLeaf();
+            return;
+        }
+        mid = first + count / 2;
+        nth_element(d_indices.begin() + first, d_indices.begin() + mid,
+                    d_indices.begin() + last,
+                    [&](unsigned lhs, unsigned rhs)
+                    {
+                        return centroids[lhs].data[axis] < centroids[rhs].data[axis];
+                    });
+    }
+
+    // Left child directly follows its parent, the right one after the
+    // complete left subtree.
+    d_nodes.push_back(Node());
+    buildNode(boxes, centroids, first, mid, maxLeafSize, depth + 1);
+
+    d_nodes[nodeIdx].offset = d_nodes.size();
+    d_nodes[nodeIdx].count = 0;
+    d_nodes.push_back(Node());
+    buildNode(boxes, centroids, mid, last, maxLeafSize, depth + 1);
+}
@@ -0,0 +1,192 @@
+
+#ifndef BVH_H_
+#define BVH_H_
+
+#include "aabb.h"
+#include "packet.h"
+#include "ray.h"
+#include "triple.h"
+
+#include <vector>
+
+// Bounding volume hierarchy over a set of boxes, built with the surface
+// area heuristic (SAH). The tree only refers to the boxes it was built from
+// by position: interpreting those is left to the caller.
+//
+// order() lists the box indices such that every leaf covers a contiguous
+// range of it. Traversal reports leaves as such ranges of slots into
+// order(), so a caller storing its primitives in that order can process a
+// leaf as one block of consecutive memory.
+class BVH
+{
+    struct Node
+    {
+        AABB box;
+        unsigned offset;    // leaf: first index, inner: index of right child
+        unsigned count;     // number of indices in a leaf, 0 for inner nodes
+    };
+
+    std::vector<Node> d_nodes;
+    std::vector<unsigned> d_indices;
+
+    public:
+        // (Re)build the tree. Leaves will hold at most maxLeafSize boxes.
+        void build(std::vector<AABB> const &boxes, unsigned maxLeafSize = 4);
+
+        bool empty() const;
+        unsigned numNodes() const;
+
+        // order()[slot] is the index of the box at the given slot
+        std::vector<unsigned> const &order() const;
+
+        // Visit the leaves the ray may hit within [ray.tMin, ray.tMax],
+        // roughly front to back. visit(first, count) is called with the
+        // range of slots (see order()) of a leaf and may lower ray.tMax (e.g.
+        // after finding a closer hit). If visit returns true the traversal
+        // stops and true is returned.
+        template <typename Visitor>
+        bool traverse(Ray &ray, Visitor visit) const;
+
+        // The same for a packet of rays: the leaves hit by any of them are
+        // visited, ordered by the nearest ray. visit may lower the tMax of
+        // any ray in the packet.
+        template <typename Visitor>
+        bool traverse(RayPacket &packet, Visitor visit) const;
+
+    private:
+        void buildNode(std::vector<AABB> const &boxes,
+                       std::vector<Point> const &centroids,
+                       unsigned first, unsigned last,
+                       unsigned maxLeafSize, unsigned depth);
+};
+
+template <typename Visitor>
+bool BVH::traverse(Ray &ray, Visitor visit) const
+{
+    if (d_nodes.empty())
+        return false;
+
+    Vector invD(1.0 / ray.D.x, 1.0 / ray.D.y, 1.0 / ray.D.z);
+
+    double tEntry;
+    if (not d_nodes[0].box.intersect(ray, invD, tEntry))
+        return false;
+
+    // Depth of a SAH tree is bounded in practice; 64 levels suffice.
+    unsigned stack[64];
+    unsigned top = 0;
+    unsigned current = 0;
+
+    while (true)
+    {
+        Node const &node = d_nodes[current];
+        if (node.count > 0)
+        {
+            if (visit(node.offset, node.count))
+                return true;
+        }
+        else
+        {
+            unsigned left = current + 1;
+            unsigned right = node.offset;
+            double tLeft;
+            double tRight;
+            bool hitLeft = d_nodes[left].box.intersect(ray, invD, tLeft);
+            bool hitRight = d_nodes[right].box.intersect(ray, invD, tRight);
+
+            if (hitLeft and hitRight)
+            {
+                // Descend into the nearest child first, postpone the other.
+                if (tRight < tLeft)
+                    std::swap(left, right);
+                stack[top++] = right;
+                current = left;
+                continue;
+            }
+            if (hitLeft)
+            {
+                current = left;
+                continue;
+            }
+            if (hitRight)
+            {
+                current = right;
+                continue;
+            }
+        }
+
+        // Pop the next postponed node that is still within reach.
+        while (true)
+        {
+            if (top == 0)
+                return false;
+            current = stack[--top];
+            if (d_nodes[current].box.intersect(ray, invD, tEntry))
+                break;
+        }
+    }
+}
+
+template <typename Visitor>
+bool BVH::traverse(RayPacket &packet, Visitor visit) const
+{
+    if (d_nodes.empty())
+        return false;
+
+    double tEntry;
+    if (not d_nodes[0].box.intersect(packet, tEntry))
+        return false;
+
+    unsigned stack[64];
+    unsigned top = 0;
+    unsigned current = 0;
+
+    while (true)
+    {
+        Node const &node = d_nodes[current];
+        if (node.count > 0)
+        {
+            if (visit(node.offset, node.count))
+                return true;
+        }
+        else
+        {
+            unsigned left = current + 1;
+            unsigned right = node.offset;
+            double tLeft;
+            double tRight;
+            bool hitLeft = d_nodes[left].box.intersect(packet, tLeft);
+            bool hitRight = d_nodes[right].box.intersect(packet, tRight);
+
+            if (hitLeft and hitRight)
+            {
+                if (tRight < tLeft)
+                    std::swap(left, right);
+                stack[top++] = right;
+                current = left;
+                continue;
+            }
+            if (hitLeft)
+            {
+                current = left;
+                continue;
+            }
+            if (hitRight)
+            {
+                current = right;
+                continue;
+            }
+        }
+
+        while (true)
+        {
+            if (top == 0)
+                return false;
+            current = stack[--top];
+            if (d_nodes[current].box.intersect(packet, tEntry))
+                break;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,102 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+namespace
+{
+    char const MAGIC[8] = {'R', 'T', '2', 'C', 'K', 'P', 'T', '1'};
+
+    template <typename T>
+    void write(ofstream &out, T const &value)
+    {
+        out.write(reinterpret_cast<char const *>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    void read(ifstream &in, T &value)
+    {
+        in.read(reinterpret_cast<char *>(&value), sizeof(T));
+    }
+}
+
+Checkpoint::Checkpoint(uint64_t key, unsigned width, unsigned height,
+                       unsigned numTiles)
+:
+    key(key),
+    width(width),
+    height(height),
+    tilesDone(numTiles, 0),
+    pixels(width * height, Color(0.0, 0.0, 0.0)),
+    counts(width * height, 0)
+{}
+
+bool Checkpoint::load(string const &filename)
+{
+    ifstream in(filename, ios::binary);
+    if (!in)
+        return false;
+
+    char magic[sizeof(MAGIC)];
+    in.read(magic, sizeof(magic));
+    uint64_t fileKey;
+    uint32_t fileWidth;
+    uint32_t fileHeight;
+    uint32_t numTiles;
+    read(in, fileKey);
+    read(in, fileWidth);
+    read(in, fileHeight);
+    read(in, numTiles);
+    if (!in or memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 or fileKey != key
+        or fileWidth != width or fileHeight != height
+        or numTiles != tilesDone.size())
+        return false;
+
+    // Read into copies, so a truncated file changes nothing.
+    vector<unsigned char> fileTiles(numTiles);
+    vector<Color> filePixels(width * height);
+    vector<unsigned> fileCounts(width * height);
+    in.read(reinterpret_cast<char *>(fileTiles.data()), numTiles);
+    for (Color &pixel : filePixels)
+        for (double &channel : pixel.data)
+            read(in, channel);
+    for (unsigned &count : fileCounts)
+    {
+        uint32_t value;
+        read(in, value);
+        count = value;
+    }
+    if (!in)
+        return false;
+
+    tilesDone.swap(fileTiles);
+    pixels.swap(filePixels);
+    counts.swap(fileCounts);
+    return true;
+}
+
+bool Checkpoint::save(string const &filename) const
+{
+    string temporary = filename + ".tmp";
+    {
+        ofstream out(temporary, ios::binary | ios::trunc);
+        out.write(MAGIC, sizeof(MAGIC));
+        write(out, key);
+        write(out, static_cast<uint32_t>(width));
+        write(out, static_cast<uint32_t>(height));
+        write(out, static_cast<uint32_t>(tilesDone.size()));
+        out.write(reinterpret_cast<char const *>(tilesDone.data()),
+                  tilesDone.size());
+        for (Color const &pixel : pixels)
+            for (double channel : pixel.data)
+                write(out, channel);
+        for (unsigned count : counts)
+            write(out, static_cast<uint32_t>(count));
+        if (!out.flush())
+            return false;
+    }
+    return rename(temporary.c_str(), filename.c_str()) == 0;
+}
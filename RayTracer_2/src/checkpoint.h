@@ -0,0 +1,38 @@
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include "triple.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The state of an unfinished render, saved to a file so a later run can
+// carry on where it stopped. A tile render keeps the tiles it finished and
+// their pixels, a progressive one the sum and number of samples per pixel.
+// The key tells renders apart: a checkpoint only applies to a render with
+// the same key (scene file and settings).
+struct Checkpoint
+{
+    uint64_t key = 0;
+    unsigned width = 0;
+    unsigned height = 0;
+    std::vector<unsigned char> tilesDone;   // per tile: 1 if finished
+    std::vector<Color> pixels;              // y * width + x
+    std::vector<unsigned> counts;
+
+    Checkpoint() = default;
+    Checkpoint(uint64_t key, unsigned width, unsigned height,
+               unsigned numTiles);
+
+    // Replaces this one by the checkpoint in the file, if there is one
+    // with the same key and size. Returns whether there was.
+    bool load(std::string const &filename);
+
+    // Writes to a temporary file first, so a render killed while saving
+    // still has its previous checkpoint.
+    bool save(std::string const &filename) const;
+};
+
+#endif
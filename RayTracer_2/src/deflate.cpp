@@ -0,0 +1,589 @@
+#include "deflate.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+    size_t const WINDOW_SIZE = 32768;   // farthest a repeat may look back
+    unsigned const MIN_MATCH = 3;
+    unsigned const MAX_MATCH = 258;
+    unsigned const HASH_BITS = 15;
+    size_t const BLOCK_TOKENS = 1 << 15;
+    size_t const MAX_STORED = 65535;    // bytes per stored block
+    size_t const NONE = ~size_t(0);
+
+    // Searched matches and the length that is good enough, per level
+    unsigned const MAX_CHAIN[10] = {0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+    unsigned const NICE_LENGTH[10] = {0, 8, 16, 32, 64, 128, 128, 258, 258,
+                                      258};
+
+    unsigned const LENGTH_BASE[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51,
+        59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    unsigned const LENGTH_EXTRA[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,
+        4, 5, 5, 5, 5, 0};
+    unsigned const DISTANCE_BASE[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+        513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+        24577};
+    unsigned const DISTANCE_EXTRA[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10,
+        10, 11, 11, 12, 12, 13, 13};
+
+    // Order in which the lengths of the code length code are stored
+    unsigned const CODE_LENGTH_ORDER[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    unsigned const NUM_LITERALS = 286;  // literals, end of block, lengths
+    unsigned const NUM_DISTANCES = 30;
+    unsigned const END_OF_BLOCK = 256;
+
+    unsigned lengthCode(unsigned length)
+    {
+        return upper_bound(LENGTH_BASE, LENGTH_BASE + 29, length)
+               - LENGTH_BASE - 1;
+    }
+
+    unsigned distanceCode(unsigned distance)
+    {
+        return upper_bound(DISTANCE_BASE, DISTANCE_BASE + 30, distance)
+               - DISTANCE_BASE - 1;
+    }
+
+    uint32_t hashBytes(unsigned char const *bytes)
+    {
+        uint32_t value = bytes[0] << 16 | bytes[1] << 8 | bytes[2];
+        return (value * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    // Huffman code lengths for the frequencies, at most maxBits long. If
+    // the optimal code is too long, the frequencies are flattened (halved)
+    // until it fits.
+    vector<unsigned> codeLengths(vector<uint32_t> const &freqs,
+                                 unsigned maxBits)
+    {
+        vector<unsigned> lengths(freqs.size(), 0);
+        vector<uint32_t> weights = freqs;
+        while (true)
+        {
+            vector<unsigned> symbols;
+            for (unsigned symbol = 0; symbol != weights.size(); ++symbol)
+                if (weights[symbol] != 0)
+                    symbols.push_back(symbol);
+            if (symbols.empty())
+                return lengths;
+            if (symbols.size() == 1)
+            {
+                lengths[symbols[0]] = 1;
+                return lengths;
+            }
+            stable_sort(symbols.begin(), symbols.end(),
+                        [&](unsigned lhs, unsigned rhs)
+                        {
+                            return weights[lhs] < weights[rhs];
+                        });
+
+            // Two queues: the sorted leaves, and the inner nodes, which are
+            // made in order of weight as well.
+            size_t numLeaves = symbols.size();
+            size_t numNodes = 2 * numLeaves - 1;
+            vector<uint64_t> weight(numNodes);
+            vector<size_t> parent(numNodes);
+            for (size_t leaf = 0; leaf != numLeaves; ++leaf)
+                weight[leaf] = weights[symbols[leaf]];
+            size_t leaf = 0;
+            size_t inner = numLeaves;
+            auto lightest = [&](size_t next)
+            {
+                if (leaf < numLeaves
+                    and (inner == next or weight[leaf] <= weight[inner]))
+                    return leaf++;
+                return inner++;
+            };
+            for (size_t next = numLeaves; next != numNodes; ++next)
+            {
+                size_t first = lightest(next);
+                size_t second = lightest(next);
+                weight[next] = weight[first] + weight[second];
+                parent[first] = next;
+                parent[second] = next;
+            }
+
+            // Parents come after their children, the root last.
+            vector<unsigned> depth(numNodes, 0);
+            unsigned maxDepth = 0;
+            for (size_t node = numNodes - 1; node-- != 0; )
+            {
+                depth[node] = depth[parent[node]] + 1;
+                maxDepth = max(maxDepth, depth[node]);
+            }
+            if (maxDepth <= maxBits)
+            {
+                for (size_t leaf = 0; leaf != numLeaves; ++leaf)
+                    lengths[symbols[leaf]] = depth[leaf];
+                return lengths;
+            }
+            for (uint32_t &value : weights)
+                if (value != 0)
+                    value = (value + 1) / 2;
+        }
+    }
+
+    // The canonical codes of the lengths, bit reversed as deflate writes
+    // them
+    vector<uint32_t> canonicalCodes(vector<unsigned> const &lengths)
+    {
+        unsigned counts[16] = {0};
+        for (unsigned length : lengths)
+            ++counts[length];
+        counts[0] = 0;
+
+        uint32_t next[16] = {0};
+        uint32_t code = 0;
+        for (unsigned bits = 1; bits != 16; ++bits)
+        {
+            code = (code + counts[bits - 1]) << 1;
+            next[bits] = code;
+        }
+
+        vector<uint32_t> codes(lengths.size(), 0);
+        for (size_t symbol = 0; symbol != lengths.size(); ++symbol)
+        {
+            unsigned length = lengths[symbol];
+            if (length == 0)
+                continue;
+            uint32_t value = next[length]++;
+            uint32_t reversed = 0;
+            for (unsigned bit = 0; bit != length; ++bit)
+                reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+            codes[symbol] = reversed;
+        }
+        return codes;
+    }
+
+    // A code length symbol (0 - 18) with its extra bits
+    struct LengthSymbol
+    {
+        unsigned symbol;
+        unsigned extra;
+    };
+
+    // The literal/length and distance code lengths, run length encoded
+    vector<LengthSymbol> encodeLengths(vector<unsigned> const &lengths)
+    {
+        vector<LengthSymbol> symbols;
+        for (size_t idx = 0; idx != lengths.size(); )
+        {
+            unsigned length = lengths[idx];
+            size_t run = 1;
+            while (idx + run != lengths.size() and lengths[idx + run] == length)
+                ++run;
+            idx += run;
+
+            if (length == 0)
+            {
+                for (; run >= 11; run -= min<size_t>(run, 138))
+                    symbols.push_back(
+                        {18, unsigned(min<size_t>(run, 138) - 11)});
+                if (run >= 3)
+                {
+                    symbols.push_back({17, unsigned(run - 3)});
+                    run = 0;
+                }
+            }
+            else
+            {
+                symbols.push_back({length, 0});
+                --run;
+                for (; run >= 3; run -= min<size_t>(run, 6))
+                    symbols.push_back({16, unsigned(min<size_t>(run, 6) - 3)});
+            }
+            for (; run != 0; --run)
+                symbols.push_back({length, 0});
+        }
+        return symbols;
+    }
+
+    unsigned const LENGTH_SYMBOL_EXTRA[19] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7};
+
+    vector<unsigned> fixedLiteralLengths()
+    {
+        vector<unsigned> lengths(288);
+        for (unsigned symbol = 0; symbol != 288; ++symbol)
+            lengths[symbol] = symbol < 144 ? 8 : symbol < 256 ? 9
+                              : symbol < 280 ? 7 : 8;
+        return lengths;
+    }
+}
+
+Deflater::Deflater(int level)
+:
+    d_level(max(0, min(level, 9))),
+    d_maxChain(MAX_CHAIN[d_level]),
+    d_niceLength(NICE_LENGTH[d_level]),
+    d_window(),
+    d_base(0),
+    d_pos(0),
+    d_blockStart(0),
+    d_head(d_level == 0 ? 0 : size_t(1) << HASH_BITS, NONE),
+    d_prev(d_level == 0 ? 0 : WINDOW_SIZE, NONE),
+    d_tokens(),
+    d_bits(0),
+    d_numBits(0)
+{}
+
+void Deflater::setDictionary(unsigned char const *data, size_t size)
+{
+    if (size > WINDOW_SIZE)
+    {
+        data += size - WINDOW_SIZE;
+        size = WINDOW_SIZE;
+    }
+
+    // The dictionary takes the positions before the input, and is never
+    // written itself.
+    d_window.assign(data, data + size);
+    d_pos = d_blockStart = size;
+    if (d_level == 0)
+        return;
+
+    for (size_t pos = 0; pos + MIN_MATCH <= size; ++pos)
+    {
+        uint32_t key = hashBytes(&d_window[pos]);
+        d_prev[pos % WINDOW_SIZE] = d_head[key];
+        d_head[key] = pos;
+    }
+}
+
+void Deflater::write(unsigned char const *data, size_t size,
+                     vector<unsigned char> &out)
+{
+    d_window.insert(d_window.end(), data, data + size);
+
+    // Keep the longest possible match ahead, so the output does not depend
+    // on how the input is cut into pieces.
+    size_t available = d_base + d_window.size();
+    if (available > d_pos + MAX_MATCH)
+        compress(available - MAX_MATCH, out);
+}
+
+void Deflater::flush(vector<unsigned char> &out)
+{
+    compress(d_base + d_window.size(), out);
+    emitBlock(false, out);
+
+    // An empty stored block ends on a byte boundary.
+    putBits(0, 3, out);
+    alignToByte(out);
+    putBits(0, 16, out);
+    putBits(0xffff, 16, out);
+}
+
+void Deflater::finish(vector<unsigned char> &out)
+{
+    compress(d_base + d_window.size(), out);
+    emitBlock(true, out);
+    alignToByte(out);
+}
+
+void Deflater::compress(size_t end, vector<unsigned char> &out)
+{
+    if (d_level == 0)
+    {
+        d_pos = end;
+        while (d_pos - d_blockStart >= MAX_STORED)
+            emitStored(false, out);
+    }
+
+    auto insert = [&](size_t pos)
+    {
+        uint32_t key = hashBytes(&d_window[pos - d_base]);
+        d_prev[pos % WINDOW_SIZE] = d_head[key];
+        d_head[key] = pos;
+    };
+
+    while (d_pos < end)
+    {
+        unsigned char const *bytes = &d_window[d_pos - d_base];
+        unsigned avail = min<size_t>(MAX_MATCH, end - d_pos);
+        unsigned bestLength = 0;
+        unsigned bestDistance = 0;
+        if (avail >= MIN_MATCH)
+        {
+            // Follow the earlier positions with the same hash, newest first.
+            size_t candidate = d_head[hashBytes(bytes)];
+            for (unsigned chain = d_maxChain;
+                 candidate != NONE and d_pos - candidate <= WINDOW_SIZE
+                 and chain != 0; --chain)
+            {
+                unsigned char const *other = &d_window[candidate - d_base];
+                if (other[bestLength] == bytes[bestLength])
+                {
+                    unsigned length = 0;
+                    while (length != avail and other[length] == bytes[length])
+                        ++length;
+                    if (length > bestLength)
+                    {
+                        bestLength = length;
+                        bestDistance = d_pos - candidate;
+                        if (length >= d_niceLength or length == avail)
+                            break;
+                    }
+                }
+
+                // A newer position may have taken the slot: then the
+                // chain ends.
+                size_t next = d_prev[candidate % WINDOW_SIZE];
+                if (next == NONE or next >= candidate)
+                    break;
+                candidate = next;
+            }
+            insert(d_pos);
+        }
+
+        if (bestLength >= MIN_MATCH)
+        {
+            d_tokens.push_back({uint16_t(bestLength), uint16_t(bestDistance)});
+            for (size_t pos = d_pos + 1; pos != d_pos + bestLength; ++pos)
+                if (pos + MIN_MATCH <= end)
+                    insert(pos);
+            d_pos += bestLength;
+        }
+        else
+        {
+            d_tokens.push_back({bytes[0], 0});
+            ++d_pos;
+        }
+
+        if (d_tokens.size() == BLOCK_TOKENS)
+            emitBlock(false, out);
+    }
+
+    // Drop the input no longer needed for matches or stored blocks.
+    size_t keep = min(d_blockStart,
+                      d_pos > WINDOW_SIZE ? d_pos - WINDOW_SIZE : 0);
+    if (keep - d_base >= 4 * WINDOW_SIZE)
+    {
+        d_window.erase(d_window.begin(), d_window.begin() + (keep - d_base));
+        d_base = keep;
+    }
+}
+
+void Deflater::emitBlock(bool final, vector<unsigned char> &out)
+{
+    if (d_level == 0)
+    {
+        emitStored(final, out);
+        return;
+    }
+    if (d_tokens.empty() and not final)
+        return;
+
+    // Symbol frequencies
+    vector<uint32_t> literalFreqs(NUM_LITERALS, 0);
+    vector<uint32_t> distanceFreqs(NUM_DISTANCES, 0);
+    uint64_t extraBits = 0;
+    for (Token const &token : d_tokens)
+    {
+        if (token.distance == 0)
+        {
+            ++literalFreqs[token.length];
+            continue;
+        }
+        unsigned lcode = lengthCode(token.length);
+        unsigned dcode = distanceCode(token.distance);
+        ++literalFreqs[257 + lcode];
+        ++distanceFreqs[dcode];
+        extraBits += LENGTH_EXTRA[lcode] + DISTANCE_EXTRA[dcode];
+    }
+    literalFreqs[END_OF_BLOCK] = 1;
+
+    // The codes get at least two symbols each, which every decoder accepts.
+    vector<uint32_t> literalWeights = literalFreqs;
+    vector<uint32_t> distanceWeights = distanceFreqs;
+    literalWeights[0] = max(literalWeights[0], 1u);
+    distanceWeights[0] = max(distanceWeights[0], 1u);
+    distanceWeights[1] = max(distanceWeights[1], 1u);
+    vector<unsigned> literalLengths = codeLengths(literalWeights, 15);
+    vector<unsigned> distanceLengths = codeLengths(distanceWeights, 15);
+
+    // The dynamic header: both code lengths, run length encoded with a
+    // code of their own
+    unsigned numLiterals = NUM_LITERALS;
+    while (literalLengths[numLiterals - 1] == 0)
+        --numLiterals;
+    unsigned numDistances = NUM_DISTANCES;
+    while (distanceLengths[numDistances - 1] == 0)
+        --numDistances;
+    vector<unsigned> allLengths(literalLengths.begin(),
+                                literalLengths.begin() + numLiterals);
+    allLengths.insert(allLengths.end(), distanceLengths.begin(),
+                      distanceLengths.begin() + numDistances);
+    vector<LengthSymbol> lengthSymbols = encodeLengths(allLengths);
+    vector<uint32_t> lengthFreqs(19, 0);
+    for (LengthSymbol const &entry : lengthSymbols)
+        ++lengthFreqs[entry.symbol];
+    vector<unsigned> lengthLengths = codeLengths(lengthFreqs, 7);
+    unsigned numLengthCodes = 19;
+    while (numLengthCodes > 4
+           and lengthLengths[CODE_LENGTH_ORDER[numLengthCodes - 1]] == 0)
+        --numLengthCodes;
+
+    // Sizes in bits of the three ways to write the block
+    vector<unsigned> fixedLengths = fixedLiteralLengths();
+    uint64_t dynamicBits = 3 + 14 + 3 * numLengthCodes + extraBits;
+    uint64_t fixedBits = 3 + extraBits;
+    for (LengthSymbol const &entry : lengthSymbols)
+        dynamicBits += lengthLengths[entry.symbol]
+                       + LENGTH_SYMBOL_EXTRA[entry.symbol];
+    for (unsigned symbol = 0; symbol != NUM_LITERALS; ++symbol)
+    {
+        dynamicBits += uint64_t(literalFreqs[symbol]) * literalLengths[symbol];
+        fixedBits += uint64_t(literalFreqs[symbol]) * fixedLengths[symbol];
+    }
+    for (unsigned symbol = 0; symbol != NUM_DISTANCES; ++symbol)
+    {
+        dynamicBits += uint64_t(distanceFreqs[symbol])
+                       * distanceLengths[symbol];
+        fixedBits += uint64_t(distanceFreqs[symbol]) * 5;
+    }
+    size_t rawSize = d_pos - d_blockStart;
+    uint64_t storedBits = (rawSize / MAX_STORED + 1) * (3 + 7 + 32)
+                          + 8 * uint64_t(rawSize);
+
+    if (storedBits < min(dynamicBits, fixedBits))
+    {
+        emitStored(final, out);
+        return;
+    }
+
+    vector<uint32_t> literalCodes;
+    vector<uint32_t> distanceCodes;
+    putBits(final ? 1 : 0, 1, out);
+    if (dynamicBits < fixedBits)
+    {
+        putBits(2, 2, out);
+        putBits(numLiterals - 257, 5, out);
+        putBits(numDistances - 1, 5, out);
+        putBits(numLengthCodes - 4, 4, out);
+        for (unsigned idx = 0; idx != numLengthCodes; ++idx)
+            putBits(lengthLengths[CODE_LENGTH_ORDER[idx]], 3, out);
+        vector<uint32_t> lengthCodes = canonicalCodes(lengthLengths);
+        for (LengthSymbol const &entry : lengthSymbols)
+        {
+            putBits(lengthCodes[entry.symbol], lengthLengths[entry.symbol],
+                    out);
+            putBits(entry.extra, LENGTH_SYMBOL_EXTRA[entry.symbol], out);
+        }
+        literalCodes = canonicalCodes(literalLengths);
+        distanceCodes = canonicalCodes(distanceLengths);
+    }
+    else
+    {
+        putBits(1, 2, out);
+        literalLengths = fixedLengths;
+        literalCodes = canonicalCodes(fixedLengths);
+        distanceLengths.assign(NUM_DISTANCES, 5);
+        distanceCodes = canonicalCodes(distanceLengths);
+    }
+
+    for (Token const &token : d_tokens)
+    {
+        if (token.distance == 0)
+        {
+            putBits(literalCodes[token.length], literalLengths[token.length],
+                    out);
+            continue;
+        }
+        unsigned lcode = lengthCode(token.length);
+        unsigned dcode = distanceCode(token.distance);
+        putBits(literalCodes[257 + lcode], literalLengths[257 + lcode], out);
+        putBits(token.length - LENGTH_BASE[lcode], LENGTH_EXTRA[lcode], out);
+        putBits(distanceCodes[dcode], distanceLengths[dcode], out);
+        putBits(token.distance - DISTANCE_BASE[dcode], DISTANCE_EXTRA[dcode],
+                out);
+    }
+    putBits(literalCodes[END_OF_BLOCK], literalLengths[END_OF_BLOCK], out);
+
+    d_tokens.clear();
+    d_blockStart = d_pos;
+}
+
+void Deflater::emitStored(bool final, vector<unsigned char> &out)
+{
+    // Blocks of at most MAX_STORED bytes, at least one
+    do
+    {
+        size_t size = min(MAX_STORED, d_pos - d_blockStart);
+        bool last = d_blockStart + size == d_pos;
+        putBits(final and last ? 1 : 0, 1, out);
+        putBits(0, 2, out);
+        alignToByte(out);
+        putBits(size, 16, out);
+        putBits(~size & 0xffff, 16, out);
+        unsigned char const *bytes = &d_window[d_blockStart - d_base];
+        out.insert(out.end(), bytes, bytes + size);
+        d_blockStart += size;
+    }
+    while (d_blockStart != d_pos);
+
+    d_tokens.clear();
+}
+
+void Deflater::putBits(uint32_t value, unsigned count,
+                       vector<unsigned char> &out)
+{
+    d_bits |= uint64_t(value) << d_numBits;
+    d_numBits += count;
+    while (d_numBits >= 8)
+    {
+        out.push_back(d_bits & 0xff);
+        d_bits >>= 8;
+        d_numBits -= 8;
+    }
+}
+
+void Deflater::alignToByte(vector<unsigned char> &out)
+{
+    if (d_numBits != 0)
+        out.push_back(d_bits & 0xff);
+    d_bits = 0;
+    d_numBits = 0;
+}
+
+uint32_t adler32(uint32_t adler, unsigned char const *data, size_t size)
+{
+    // At most 5552 bytes fit before the sums have to be reduced.
+    uint32_t const MOD = 65521;
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+    while (size != 0)
+    {
+        size_t count = min<size_t>(size, 5552);
+        size -= count;
+        for (; count != 0; --count)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= MOD;
+        b %= MOD;
+    }
+    return b << 16 | a;
+}
+
+uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t size2)
+{
+    // adler2 started from a first sum of 1 instead of that of adler1, which
+    // every byte of the second piece adds to the second sum.
+    uint64_t const MOD = 65521;
+    uint64_t rem = size2 % MOD;
+    uint64_t a = (adler1 & 0xffff) + (adler2 & 0xffff) + MOD - 1;
+    uint64_t b = rem * (adler1 & 0xffff) % MOD + (adler1 >> 16)
+                 + (adler2 >> 16) + MOD - rem;
+    return static_cast<uint32_t>(b % MOD << 16 | a % MOD);
+}
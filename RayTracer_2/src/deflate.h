@@ -0,0 +1,73 @@
+
+#ifndef DEFLATE_H_
+#define DEFLATE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compresses a stream of bytes into raw deflate data (RFC 1951), a piece
+// at a time, so neither the input nor the output has to be kept whole.
+// Level 0 only stores the bytes; levels 1 to 9 look for repeats (longer
+// searches at higher levels) and code every block with whichever of
+// dynamic Huffman codes, fixed codes or storing is smallest.
+class Deflater
+{
+    // A literal byte (distance 0) or a repeat of length bytes
+    struct Token
+    {
+        uint16_t length;
+        uint16_t distance;
+    };
+
+    int d_level;
+    unsigned d_maxChain;                // matches tried per position
+    unsigned d_niceLength;              // stop searching at this length
+
+    std::vector<unsigned char> d_window;    // input from position d_base
+    size_t d_base;
+    size_t d_pos;                       // next position to compress
+    size_t d_blockStart;                // first position of the block
+    std::vector<size_t> d_head;         // last position per hash
+    std::vector<size_t> d_prev;         // previous one with the same hash
+    std::vector<Token> d_tokens;        // of the block
+
+    uint64_t d_bits;                    // not yet written, lowest first
+    unsigned d_numBits;
+
+    public:
+        explicit Deflater(int level = 6);
+
+        // Lets the first bytes written refer back to the (at most) 32 kB
+        // of data before them: the input of an earlier stream this one's
+        // output is appended to. Call before anything is written.
+        void setDictionary(unsigned char const *data, size_t size);
+
+        // compress size bytes, appending whatever output is complete to out
+        void write(unsigned char const *data, size_t size,
+                   std::vector<unsigned char> &out);
+
+        // end the output on a byte boundary at which all input so far can
+        // be decoded (a sync flush); the stream then simply continues
+        void flush(std::vector<unsigned char> &out);
+
+        // end the stream
+        void finish(std::vector<unsigned char> &out);
+
+    private:
+        void compress(size_t end, std::vector<unsigned char> &out);
+        void emitBlock(bool final, std::vector<unsigned char> &out);
+        void emitStored(bool final, std::vector<unsigned char> &out);
+        void putBits(uint32_t value, unsigned count,
+                     std::vector<unsigned char> &out);
+        void alignToByte(std::vector<unsigned char> &out);
+};
+
+// Adler-32 checksum of zlib streams, continued from adler (1 for none)
+uint32_t adler32(uint32_t adler, unsigned char const *data, size_t size);
+
+// Adler-32 of two pieces of data together, from adler1 of the first and
+// adler2 of the second, which is size2 bytes
+uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t size2);
+
+#endif
@@ -0,0 +1,198 @@
+#include "denoiser.h"
+
+#include "framebuffer.h"
+#include "simd.h"
+#include "threadpool.h"
+
+using namespace std;
+using simd::Lanes;
+
+namespace
+{
+    unsigned const NUM_PASSES = 5;
+
+    // Taps of the kernel (a B3 spline) per axis
+    double const KERNEL[5] = {1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16};
+
+    // Allowed squared differences per feature. The color one halves every
+    // pass, as the noise that is left does.
+    double const COLOR_SIGMA2 = 0.25;
+    double const NORMAL_SIGMA2 = 0.1;
+    double const ALBEDO_SIGMA2 = 0.01;
+    double const DEPTH_SIGMA2 = 0.01;
+
+    // Pixels outside the image: features that no pixel comes close to
+    double const BORDER_NORMAL = 10.0;
+
+    // exp(-d) for d >= 0, as (1 - d / 64)^64: close enough for weights and
+    // made of operations the SIMD registers have.
+    Lanes negExp(Lanes d)
+    {
+        Lanes t = simd::max(simd::broadcast(1.0)
+                            - d * simd::broadcast(1.0 / 64),
+                            simd::broadcast(0.0));
+        for (unsigned square = 0; square != 6; ++square)
+            t = t * t;
+        return t;
+    }
+
+    Lanes squared(Lanes a)
+    {
+        return a * a;
+    }
+
+    // An image plane with a border wide enough for the widest pass, and rows
+    // padded to whole SIMD registers.
+    class Plane
+    {
+        unsigned d_stride;
+        std::vector<double> d_values;
+
+        public:
+            static unsigned const BORDER = 2 << (NUM_PASSES - 1);
+
+            Plane(unsigned width, unsigned height, double fill)
+            :
+                d_stride((width + 2 * BORDER + simd::WIDTH - 1)
+                         / simd::WIDTH * simd::WIDTH),
+                d_values(d_stride * (height + 2 * BORDER), fill)
+            {}
+
+            unsigned stride() const
+            {
+                return d_stride;
+            }
+
+            double &operator()(unsigned x, unsigned y)
+            {
+                return d_values[(y + BORDER) * d_stride + x + BORDER];
+            }
+
+            double const *data(unsigned x, unsigned y) const
+            {
+                return &d_values[(y + BORDER) * d_stride + x + BORDER];
+            }
+
+            double *data(unsigned x, unsigned y)
+            {
+                return &d_values[(y + BORDER) * d_stride + x + BORDER];
+            }
+    };
+}
+
+constexpr double FeatureBuffers::BACKGROUND_DEPTH;
+
+FeatureBuffers::FeatureBuffers(Tile const &window)
+:
+    x0(window.x0),
+    y0(window.y0),
+    width(window.x1 - window.x0),
+    height(window.y1 - window.y0),
+    normals(width * height, Vector(0.0, 0.0, 0.0)),
+    albedo(width * height, Color(0.0, 0.0, 0.0)),
+    depth(width * height, BACKGROUND_DEPTH)
+{}
+
+void denoise(Framebuffer &img, FeatureBuffers const &features, ThreadPool &pool)
+{
+    unsigned x0 = features.x0;
+    unsigned y0 = features.y0;
+    unsigned w = features.width;
+    unsigned h = features.height;
+
+    // Planes of the colors (two sets, read one and write the other) and of
+    // the features, so a register holds the same value of adjacent pixels.
+    vector<Plane> colors[2];
+    for (auto &set : colors)
+        set.assign(3, Plane(w, h, 0.0));
+    vector<Plane> guides(7, Plane(w, h, BORDER_NORMAL));
+    for (unsigned y = 0; y != h; ++y)
+        for (unsigned x = 0; x != w; ++x)
+        {
+            unsigned idx = y * w + x;
+            for (unsigned channel = 0; channel != 3; ++channel)
+            {
+                colors[0][channel](x, y) =
+                    img.get_pixel(x0 + x, y0 + y).data[channel];
+                guides[channel](x, y) = features.normals[idx].data[channel];
+                guides[3 + channel](x, y) = features.albedo[idx].data[channel];
+            }
+            guides[6](x, y) = features.depth[idx];
+        }
+
+    unsigned stride = guides[0].stride();
+    double colorSigma2 = COLOR_SIGMA2;
+    for (unsigned pass = 0; pass != NUM_PASSES; ++pass)
+    {
+        vector<Plane> const &in = colors[pass % 2];
+        vector<Plane> &out = colors[(pass + 1) % 2];
+        int step = 1 << pass;
+
+        Lanes invColor = simd::broadcast(1.0 / colorSigma2);
+        Lanes invNormal = simd::broadcast(1.0 / NORMAL_SIGMA2);
+        Lanes invAlbedo = simd::broadcast(1.0 / ALBEDO_SIGMA2);
+        Lanes invDepth = simd::broadcast(1.0 / DEPTH_SIGMA2);
+
+        pool.parallelFor(h, [&](unsigned y, unsigned)
+        {
+            // The row in the color planes, then in the feature planes
+            double const *rows[10];
+            for (unsigned plane = 0; plane != 3; ++plane)
+                rows[plane] = in[plane].data(0, y);
+            for (unsigned plane = 0; plane != 7; ++plane)
+                rows[3 + plane] = guides[plane].data(0, y);
+
+            for (unsigned x = 0; x < w; x += simd::WIDTH)
+            {
+                Lanes center[10];
+                for (unsigned plane = 0; plane != 10; ++plane)
+                    center[plane] = simd::load(rows[plane] + x);
+
+                Lanes sum[3] = {simd::broadcast(0.0), simd::broadcast(0.0),
+                                simd::broadcast(0.0)};
+                Lanes weights = simd::broadcast(0.0);
+                for (int dy = -2; dy <= 2; ++dy)
+                    for (int dx = -2; dx <= 2; ++dx)
+                    {
+                        int offset = step * (dy * static_cast<int>(stride) + dx);
+                        Lanes tap[10];
+                        for (unsigned plane = 0; plane != 10; ++plane)
+                            tap[plane] = simd::load(rows[plane] + x + offset);
+
+                        Lanes color = squared(tap[0] - center[0])
+                                    + squared(tap[1] - center[1])
+                                    + squared(tap[2] - center[2]);
+                        Lanes normal = squared(tap[3] - center[3])
+                                     + squared(tap[4] - center[4])
+                                     + squared(tap[5] - center[5]);
+                        Lanes albedo = squared(tap[6] - center[6])
+                                     + squared(tap[7] - center[7])
+                                     + squared(tap[8] - center[8]);
+                        Lanes depth = squared(tap[9] - center[9]);
+
+                        Lanes weight = simd::broadcast(KERNEL[dy + 2]
+                                                       * KERNEL[dx + 2])
+                                     * negExp(color * invColor
+                                              + normal * invNormal
+                                              + albedo * invAlbedo
+                                              + depth * invDepth);
+                        for (unsigned channel = 0; channel != 3; ++channel)
+                            sum[channel] = sum[channel] + weight * tap[channel];
+                        weights = weights + weight;
+                    }
+
+                // The pixel itself always counts, so weights > 0.
+                for (unsigned channel = 0; channel != 3; ++channel)
+                    simd::store(out[channel].data(x, y), sum[channel] / weights);
+            }
+        });
+        colorSigma2 /= 2;
+    }
+
+    vector<Plane> const &result = colors[NUM_PASSES % 2];
+    for (unsigned y = 0; y != h; ++y)
+        for (unsigned x = 0; x != w; ++x)
+            img.put_pixel(x0 + x, y0 + y, Color(result[0].data(x, y)[0],
+                                                result[1].data(x, y)[0],
+                                                result[2].data(x, y)[0]));
+}
@@ -0,0 +1,41 @@
+
+#ifndef DENOISER_H_
+#define DENOISER_H_
+
+#include "tiles.h"
+#include "triple.h"
+
+#include <vector>
+
+class Framebuffer;
+class ThreadPool;
+
+// What the primary rays of every pixel of a window of the image hit,
+// averaged over its samples: the normal (facing the viewer), the albedo
+// (material or texture color) and the log of the distance. Pixels showing
+// the background have a zero normal and albedo and a depth of
+// BACKGROUND_DEPTH.
+struct FeatureBuffers
+{
+    static constexpr double BACKGROUND_DEPTH = 30.0;
+
+    unsigned x0;                    // the window in the image
+    unsigned y0;
+    unsigned width;
+    unsigned height;
+    std::vector<Vector> normals;    // pixel (x0 + x, y0 + y) at index
+    std::vector<Color> albedo;      // y * width + x
+    std::vector<double> depth;
+
+    explicit FeatureBuffers(Tile const &window);
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al., 2010). Each of
+// its passes blurs with a 5 x 5 kernel whose taps lie twice as far apart
+// as in the pass before, weighing every tap down by how much its color and
+// features differ from those of the pixel. Noise within a surface is thus
+// smoothed while edges of objects, textures and shadows stay sharp. Only
+// the window of the features is filtered, the rest of img stays as it is.
+void denoise(Framebuffer &img, FeatureBuffers const &features, ThreadPool &pool);
+
+#endif
@@ -0,0 +1,271 @@
+#include "framebuffer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+    // IEEE half precision, rounded to nearest even
+    uint16_t toHalf(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint32_t sign = (bits >> 16) & 0x8000;
+        uint32_t mantissa = bits & 0x7fffff;
+        int floatExponent = (bits >> 23) & 0xff;
+        int exponent = floatExponent - 127 + 15;
+
+        if (floatExponent == 0xff)          // infinity or NaN
+            return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+        if (exponent >= 0x1f)               // too large: infinity
+            return sign | 0x7c00;
+        if (exponent <= 0)                  // subnormal, or zero
+        {
+            if (exponent < -10)
+                return sign;
+            mantissa |= 0x800000;
+            unsigned shift = 14 - exponent;
+            uint32_t half = mantissa >> shift;
+            uint32_t rest = mantissa & ((1u << shift) - 1);
+            uint32_t halfway = 1u << (shift - 1);
+            if (rest > halfway or (rest == halfway and (half & 1)))
+                ++half;
+            return sign | half;
+        }
+
+        // Rounding up may carry into the exponent, which is still right.
+        uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+        uint32_t rest = mantissa & 0x1fff;
+        if (rest > 0x1000 or (rest == 0x1000 and (half & 1)))
+            ++half;
+        return half;
+    }
+
+    float fromHalf(uint16_t half)
+    {
+        uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+        uint32_t exponent = (half >> 10) & 0x1f;
+        uint32_t mantissa = half & 0x3ff;
+
+        if (exponent == 0)                  // subnormal, or zero
+        {
+            float value = mantissa * (1.0f / (1 << 24));
+            return sign != 0 ? -value : value;
+        }
+
+        uint32_t bits = exponent == 0x1f
+                        ? sign | 0x7f800000 | (mantissa << 13)
+                        : sign | ((exponent + 127 - 15) << 23)
+                          | (mantissa << 13);
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // As Image::write_png converts a channel
+    unsigned char toByte(double value)
+    {
+        return static_cast<unsigned char>(value * 255.0);
+    }
+}
+
+size_t pixelBytes(PixelFormat format)
+{
+    switch (format)
+    {
+        case PixelFormat::DOUBLE:
+            return 3 * sizeof(double);
+        case PixelFormat::FLOAT:
+            return 3 * sizeof(float);
+        case PixelFormat::HALF:
+            return 3 * sizeof(uint16_t);
+        case PixelFormat::BYTE:
+            return 3;
+    }
+    return 0;
+}
+
+bool pixelFormatFromName(string const &name, PixelFormat &format)
+{
+    if (name == "double")
+        format = PixelFormat::DOUBLE;
+    else if (name == "float")
+        format = PixelFormat::FLOAT;
+    else if (name == "half")
+        format = PixelFormat::HALF;
+    else if (name == "8bit")
+        format = PixelFormat::BYTE;
+    else
+        return false;
+    return true;
+}
+
+Framebuffer::Framebuffer(unsigned width, unsigned height, PixelFormat format)
+:
+    d_width(width),
+    d_height(height),
+    d_format(format),
+    d_pixelBytes(pixelBytes(format)),
+    d_tilesX(0),
+    d_pixels(static_cast<size_t>(width) * height * d_pixelBytes, 0),
+    d_data(d_pixels.data()),
+    d_mappedBytes(0)
+{}
+
+Framebuffer::Framebuffer(unsigned width, unsigned height, PixelFormat format,
+                         string const &filename)
+:
+    d_width(width),
+    d_height(height),
+    d_format(format),
+    d_pixelBytes(pixelBytes(format)),
+    d_tilesX((width + TILE_SIZE - 1) / TILE_SIZE),
+    d_pixels(),
+    d_data(nullptr),
+    d_mappedBytes(0)
+{
+    size_t tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    size_t bytes = d_tilesX * tilesY * TILE_SIZE * TILE_SIZE * d_pixelBytes;
+
+    // A new file is all zeros, which are black pixels.
+    int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        throw runtime_error("Could not create framebuffer file "
+                            + filename + ".");
+    unlink(filename.c_str());
+    void *memory = MAP_FAILED;
+    if (ftruncate(fd, bytes) == 0)
+        memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+    close(fd);      // the mapping keeps the file
+    if (memory == MAP_FAILED)
+        throw runtime_error("Could not map framebuffer file "
+                            + filename + ".");
+
+    d_data = static_cast<unsigned char *>(memory);
+    d_mappedBytes = bytes;
+}
+
+Framebuffer::~Framebuffer()
+{
+    if (d_mappedBytes != 0)
+        munmap(d_data, d_mappedBytes);
+}
+
+unsigned Framebuffer::width() const
+{
+    return d_width;
+}
+
+unsigned Framebuffer::height() const
+{
+    return d_height;
+}
+
+size_t Framebuffer::size() const
+{
+    return static_cast<size_t>(d_width) * d_height;
+}
+
+PixelFormat Framebuffer::format() const
+{
+    return d_format;
+}
+
+unsigned Framebuffer::tileSize() const
+{
+    return d_tilesX == 0 ? 0 : TILE_SIZE;
+}
+
+Color Framebuffer::get_pixel(unsigned x, unsigned y) const
+{
+    unsigned char const *pixel = d_data + index(x, y) * d_pixelBytes;
+    Color color;
+    switch (d_format)
+    {
+        case PixelFormat::DOUBLE:
+            memcpy(color.data, pixel, sizeof(color.data));
+            break;
+        case PixelFormat::FLOAT:
+        {
+            float channels[3];
+            memcpy(channels, pixel, sizeof(channels));
+            color = Color(channels[0], channels[1], channels[2]);
+            break;
+        }
+        case PixelFormat::HALF:
+        {
+            uint16_t channels[3];
+            memcpy(channels, pixel, sizeof(channels));
+            color = Color(fromHalf(channels[0]), fromHalf(channels[1]),
+                          fromHalf(channels[2]));
+            break;
+        }
+        case PixelFormat::BYTE:
+            color = Color(pixel[0] / 255.0, pixel[1] / 255.0,
+                          pixel[2] / 255.0);
+            break;
+    }
+    return color;
+}
+
+void Framebuffer::put_pixel(unsigned x, unsigned y, Color const &c)
+{
+    unsigned char *pixel = d_data + index(x, y) * d_pixelBytes;
+    switch (d_format)
+    {
+        case PixelFormat::DOUBLE:
+            memcpy(pixel, c.data, sizeof(c.data));
+            break;
+        case PixelFormat::FLOAT:
+        {
+            float channels[3] = {static_cast<float>(c.r),
+                                 static_cast<float>(c.g),
+                                 static_cast<float>(c.b)};
+            memcpy(pixel, channels, sizeof(channels));
+            break;
+        }
+        case PixelFormat::HALF:
+        {
+            uint16_t channels[3] = {toHalf(c.r), toHalf(c.g), toHalf(c.b)};
+            memcpy(pixel, channels, sizeof(channels));
+            break;
+        }
+        case PixelFormat::BYTE:
+            pixel[0] = toByte(c.r);
+            pixel[1] = toByte(c.g);
+            pixel[2] = toByte(c.b);
+            break;
+    }
+}
+
+void Framebuffer::release(Tile const &tile) const
+{
+    if (d_mappedBytes == 0)
+        return;
+
+    // Only whole pages of the tiles the pixels lie in can be released.
+    size_t const tileBytes = TILE_SIZE * TILE_SIZE * d_pixelBytes;
+    size_t const pageSize = sysconf(_SC_PAGESIZE);
+    char *base = reinterpret_cast<char *>(d_data);
+    for (unsigned y = tile.y0 / TILE_SIZE * TILE_SIZE; y < tile.y1;
+         y += TILE_SIZE)
+        for (unsigned x = tile.x0 / TILE_SIZE * TILE_SIZE; x < tile.x1;
+             x += TILE_SIZE)
+        {
+            size_t first = index(x, y) * d_pixelBytes;
+            size_t begin = (first + pageSize - 1) / pageSize * pageSize;
+            size_t end = (first + tileBytes) / pageSize * pageSize;
+            if (begin >= end)
+                continue;
+            msync(base + begin, end - begin, MS_ASYNC);
+            madvise(base + begin, end - begin, MADV_DONTNEED);
+        }
+}
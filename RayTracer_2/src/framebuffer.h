@@ -0,0 +1,96 @@
+
+#ifndef FRAMEBUFFER_H_
+#define FRAMEBUFFER_H_
+
+#include "tiles.h"
+#include "triple.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// How a framebuffer stores the color of a pixel
+enum class PixelFormat
+{
+    DOUBLE,     // three doubles: exact
+    FLOAT,      // three floats
+    HALF,       // three 16 bit floats
+    BYTE        // the three bytes of the PNG, rounded down as it is written;
+                // for renders that do not read their pixels back
+};
+
+// bytes per pixel of the format
+size_t pixelBytes(PixelFormat format);
+
+// the format called name ("double", "float", "half" or "8bit"), returns
+// false if there is none
+bool pixelFormatFromName(std::string const &name, PixelFormat &format);
+
+// The image a render draws into. Normally its pixels are kept in memory
+// row by row. Images too large for that are kept in a file mapped into
+// memory instead, in TILE_SIZE x TILE_SIZE tiles stored one after the
+// other, so a finished tile can be handed back to the system (release())
+// and only the tiles being rendered take up memory.
+class Framebuffer
+{
+    unsigned d_width;
+    unsigned d_height;
+    PixelFormat d_format;
+    size_t d_pixelBytes;
+    unsigned d_tilesX;              // tiles per row, 0: stored row by row
+    std::vector<unsigned char> d_pixels;    // the pixels, if in memory
+    unsigned char *d_data;          // the pixels, wherever they are
+    size_t d_mappedBytes;           // size of the mapped file, or 0
+
+    public:
+        // Side of a tile of a mapped framebuffer: a tile then takes a whole
+        // number of (4 kB) pages in every format.
+        static unsigned const TILE_SIZE = 64;
+
+        // A black width x height framebuffer in memory
+        Framebuffer(unsigned width, unsigned height,
+                    PixelFormat format = PixelFormat::DOUBLE);
+
+        // The same, mapped from a new file of that name. The file is
+        // removed right away, so only its space on disk is used, until the
+        // framebuffer is destroyed. Throws runtime_error if the file cannot
+        // be made.
+        Framebuffer(unsigned width, unsigned height, PixelFormat format,
+                    std::string const &filename);
+
+        ~Framebuffer();
+
+        Framebuffer(Framebuffer const &) = delete;
+        Framebuffer &operator=(Framebuffer const &) = delete;
+
+        unsigned width() const;
+        unsigned height() const;
+        size_t size() const;
+        PixelFormat format() const;
+
+        // side of the tiles the pixels are stored in, 0 if row by row
+        unsigned tileSize() const;
+
+        // the color is converted to and from the format
+        Color get_pixel(unsigned x, unsigned y) const;
+        void put_pixel(unsigned x, unsigned y, Color const &c);
+
+        // The pixels of tile are not needed for now. Those of a mapped
+        // framebuffer are written back to the file and their memory freed;
+        // using them again loads them from the file.
+        void release(Tile const &tile) const;
+
+    private:
+        size_t index(unsigned x, unsigned y) const
+        {
+            if (d_tilesX == 0)
+                return static_cast<size_t>(y) * d_width + x;
+
+            size_t tile = static_cast<size_t>(y / TILE_SIZE) * d_tilesX
+                          + x / TILE_SIZE;
+            return tile * TILE_SIZE * TILE_SIZE
+                   + y % TILE_SIZE * TILE_SIZE + x % TILE_SIZE;
+        }
+};
+
+#endif
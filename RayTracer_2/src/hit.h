@@ -1,3 +1,4 @@
+
 #ifndef HIT_H_
 #define HIT_H_
 
@@ -8,20 +9,27 @@ class Hit
 {
     public:
         double t;   // distance of hit
+
+        // Set by Object::intersect: primitive-local coordinates of the hit
+        // (their meaning depends on the shape), enough for finalize() to
+        // derive the rest from without repeating the intersection.
+        double u;
+        double v;
+
+        // Set by Object::finalize, only for the hit that is shaded
         Vector N;   // Normal at hit
+        Vector uv;  // texture coordinates (uv.x, uv.y), if textured
 
-        Hit(double time, Vector const &normal)
+        Hit(double time, double u = 0.0, double v = 0.0)
         :
             t(time),
-            N(normal)
+            u(u),
+            v(v)
         {}
 
         static Hit const NO_HIT()
         {
-            static Hit no_hit(std::numeric_limits<double>::quiet_NaN(),
-                              Vector(std::numeric_limits<double>::quiet_NaN(),
-                                     std::numeric_limits<double>::quiet_NaN(),
-                                     std::numeric_limits<double>::quiet_NaN()));
+            static Hit no_hit(std::numeric_limits<double>::quiet_NaN());
             return no_hit;
         }
 };
@@ -80,7 +80,14 @@ void Image::write_png(std::string const &filename) const
 void Image::read_png(std::string const &filename)
 {
     vector<unsigned char> image;
-    lodepng::decode(image, d_width, d_height, filename);
+    d_pixels.clear();
+    if (lodepng::decode(image, d_width, d_height, filename) != 0)
+    {
+        // Not a readable PNG: an empty image
+        d_width = 0;
+        d_height = 0;
+        return;
+    }
     d_pixels.reserve(size());
 
     auto imgIter = image.begin();
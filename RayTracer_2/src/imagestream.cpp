@@ -0,0 +1,87 @@
+#include "imagestream.h"
+
+#include <algorithm>
+
+using namespace std;
+
+ImageStream::ImageStream(Framebuffer const &img, OutputSink &sink,
+                         Tile const &output, Tile const &window)
+:
+    d_img(img),
+    d_sink(sink),
+    d_output(output),
+    d_pending(output.y1 - output.y0, 0),
+    d_nextRow(output.y0),
+    d_releasedRow(output.y0)
+{
+    unsigned x0 = max(output.x0, window.x0);
+    unsigned x1 = min(output.x1, window.x1);
+    if (x0 >= x1)
+        return;
+
+    for (unsigned y = max(output.y0, window.y0);
+         y < min(output.y1, window.y1); ++y)
+        d_pending[y - output.y0] = x1 - x0;
+}
+
+void ImageStream::tileDone(Tile const &tile)
+{
+    lock_guard<mutex> lock(d_mutex);
+
+    unsigned x0 = max(tile.x0, d_output.x0);
+    unsigned x1 = min(tile.x1, d_output.x1);
+    if (x0 < x1)
+        for (unsigned y = max(tile.y0, d_output.y0);
+             y < min(tile.y1, d_output.y1); ++y)
+            d_pending[y - d_output.y0] -= x1 - x0;
+
+    unsigned end = d_nextRow;
+    while (end != d_output.y1 and d_pending[end - d_output.y0] == 0)
+        ++end;
+    if (end == d_nextRow)
+        return;
+
+    writeRows(end);
+    d_sink.flush();
+}
+
+bool ImageStream::finish()
+{
+    lock_guard<mutex> lock(d_mutex);
+    writeRows(d_output.y1);
+    return d_sink.end();
+}
+
+void ImageStream::writeRows(unsigned end)
+{
+    if (not d_begun)
+    {
+        d_sink.begin(d_output.x1 - d_output.x0, d_output.y1 - d_output.y0);
+        d_begun = true;
+    }
+
+    // Rows of a framebuffer stored in tiles are handed back a whole row of
+    // tiles at a time, once written.
+    unsigned size = d_img.tileSize();
+    vector<Color> row(d_output.x1 - d_output.x0);
+    for (; d_nextRow != end; ++d_nextRow)
+    {
+        for (unsigned x = d_output.x0; x != d_output.x1; ++x)
+            row[x - d_output.x0] = d_img.get_pixel(x, d_nextRow);
+        d_sink.writeRow(row.data());
+
+        unsigned next = d_nextRow + 1;
+        if (size != 0 and (next % size == 0 or next == d_output.y1))
+        {
+            d_img.release(Tile{d_output.x0, d_releasedRow, d_output.x1,
+                               next});
+            d_releasedRow = next;
+        }
+    }
+}
+
+bool writeImage(Framebuffer const &img, OutputSink &sink, Tile const &output)
+{
+    ImageStream stream(img, sink, output, output);
+    return stream.finish();
+}
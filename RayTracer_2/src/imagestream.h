@@ -0,0 +1,49 @@
+
+#ifndef IMAGESTREAM_H_
+#define IMAGESTREAM_H_
+
+#include "framebuffer.h"
+#include "outputsink.h"
+#include "tiles.h"
+
+#include <mutex>
+#include <vector>
+
+// Writes the rows of a framebuffer to a sink while it is rendered: a row
+// goes out as soon as it and all rows above it are done. Rows are done
+// once every tile covering them is (tileDone()); rows outside the window
+// being rendered are done from the start.
+class ImageStream
+{
+    Framebuffer const &d_img;
+    OutputSink &d_sink;
+    Tile d_output;                      // the part of the image written
+    std::vector<unsigned> d_pending;    // per output row: pixels to render
+    unsigned d_nextRow;                 // the first row not yet written
+    unsigned d_releasedRow;             // rows above this were released
+    bool d_begun = false;
+    std::mutex d_mutex;
+
+    public:
+        // the rows of output of img, of which the pixels in window are
+        // still to be rendered
+        ImageStream(Framebuffer const &img, OutputSink &sink,
+                    Tile const &output, Tile const &window);
+
+        // the pixels of tile are done; may be called from any thread
+        void tileDone(Tile const &tile);
+
+        // write whatever rows are left, done or not, and end the image;
+        // returns whether all of it was written
+        bool finish();
+
+    private:
+        // write rows up to end (under the lock)
+        void writeRows(unsigned end);
+};
+
+// write the output part of img to sink at once, returns whether it was
+// written
+bool writeImage(Framebuffer const &img, OutputSink &sink, Tile const &output);
+
+#endif
@@ -3,11 +3,6 @@
 
 #include "triple.h"
 
-// Declare LightPtr for use in Scene class
-#include <memory>
-class Light;
-typedef std::shared_ptr<Light> LightPtr;
-
 class Light
 {
     public:
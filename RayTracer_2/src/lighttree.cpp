@@ -0,0 +1,71 @@
+#include "lighttree.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void LightTree::build(vector<Light> const &lights)
+{
+    d_nodes.clear();
+    if (lights.empty())
+        return;
+
+    vector<unsigned> indices(lights.size());
+    for (unsigned idx = 0; idx != lights.size(); ++idx)
+        indices[idx] = idx;
+
+    // A binary tree with one light per leaf has 2N - 1 nodes.
+    d_nodes.reserve(2 * lights.size() - 1);
+    d_nodes.push_back(Node());
+    buildNode(lights, indices, 0, lights.size());
+}
+
+bool LightTree::empty() const
+{
+    return d_nodes.empty();
+}
+
+// Builds the node at the back of d_nodes over indices[first, last), split
+// at the median along the longest axis of the light positions.
+void LightTree::buildNode(vector<Light> const &lights,
+                          vector<unsigned> &indices,
+                          unsigned first, unsigned last)
+{
+    unsigned nodeIdx = d_nodes.size() - 1;
+
+    AABB box;
+    Color power(0.0, 0.0, 0.0);
+    for (unsigned idx = first; idx != last; ++idx)
+    {
+        box.extend(lights[indices[idx]].position);
+        power += lights[indices[idx]].color;
+    }
+    d_nodes[nodeIdx].box = box;
+    d_nodes[nodeIdx].power = power;
+
+    if (last - first == 1)
+    {
+        d_nodes[nodeIdx].leaf = true;
+        d_nodes[nodeIdx].offset = indices[first];
+        return;
+    }
+
+    unsigned axis = box.longestAxis();
+    unsigned mid = first + (last - first) / 2;
+    nth_element(indices.begin() + first, indices.begin() + mid,
+                indices.begin() + last,
+                [&](unsigned lhs, unsigned rhs)
+                {
+                    return lights[lhs].position.data[axis]
+                         < lights[rhs].position.data[axis];
+                });
+
+    // The left child directly follows its parent.
+    d_nodes[nodeIdx].leaf = false;
+    d_nodes.push_back(Node());
+    buildNode(lights, indices, first, mid);
+
+    d_nodes[nodeIdx].offset = d_nodes.size();
+    d_nodes.push_back(Node());
+    buildNode(lights, indices, mid, last);
+}
@@ -0,0 +1,126 @@
+
+#ifndef LIGHTTREE_H_
+#define LIGHTTREE_H_
+
+#include "aabb.h"
+#include "light.h"
+#include "triple.h"
+
+#include <vector>
+
+// Binary tree over the lights of a scene. Every node bounds the positions
+// of its lights and sums their colors (its power), so a shading point can
+// estimate the contribution of a whole group of lights at once. Leaves
+// hold a single light.
+//
+// How much a group may contribute is left to the caller: importance(box,
+// power) must return an upper bound of it, 0 if it is certainly nothing.
+class LightTree
+{
+    struct Node
+    {
+        AABB box;
+        Color power;
+        unsigned offset;    // leaf: index of the light, inner: right child
+        bool leaf;
+    };
+
+    std::vector<Node> d_nodes;
+
+    public:
+        void build(std::vector<Light> const &lights);
+
+        bool empty() const;
+
+        // Call visit(light) for every light whose importance exceeds the
+        // threshold, skipping all groups of lights that do not.
+        template <typename Importance, typename Visitor>
+        void select(Importance importance, double threshold,
+                    Visitor visit) const;
+
+        // Choose a single light, going down the tree and picking a child
+        // with a probability proportional to its importance; u is a uniform
+        // number in [0, 1). Returns false if no light is important at all.
+        template <typename Importance>
+        bool sample(Importance importance, double u, unsigned &light,
+                    double &probability) const;
+
+    private:
+        void buildNode(std::vector<Light> const &lights,
+                       std::vector<unsigned> &indices,
+                       unsigned first, unsigned last);
+};
+
+template <typename Importance, typename Visitor>
+void LightTree::select(Importance importance, double threshold,
+                       Visitor visit) const
+{
+    if (d_nodes.empty())
+        return;
+
+    unsigned stack[64];
+    unsigned top = 0;
+    stack[top++] = 0;
+    while (top != 0)
+    {
+        unsigned current = stack[--top];
+        Node const &node = d_nodes[current];
+        if (importance(node.box, node.power) <= threshold)
+            continue;
+
+        if (node.leaf)
+        {
+            visit(node.offset);
+            continue;
+        }
+        stack[top++] = node.offset;
+        stack[top++] = current + 1;
+    }
+}
+
+template <typename Importance>
+bool LightTree::sample(Importance importance, double u, unsigned &light,
+                       double &probability) const
+{
+    if (d_nodes.empty())
+        return false;
+
+    probability = 1.0;
+    unsigned current = 0;
+    if (importance(d_nodes[0].box, d_nodes[0].power) <= 0.0)
+        return false;
+
+    while (not d_nodes[current].leaf)
+    {
+        unsigned left = current + 1;
+        unsigned right = d_nodes[current].offset;
+        double leftImportance = importance(d_nodes[left].box,
+                                           d_nodes[left].power);
+        double rightImportance = importance(d_nodes[right].box,
+                                            d_nodes[right].power);
+        double total = leftImportance + rightImportance;
+        if (not (total > 0.0))
+            return false;
+
+        // Reuse u for the next level by stretching the chosen part of
+        // [0, 1) back to all of it.
+        double pLeft = leftImportance / total;
+        if (u < pLeft)
+        {
+            probability *= pLeft;
+            u /= pLeft;
+            current = left;
+        }
+        else
+        {
+            probability *= 1.0 - pLeft;
+            u = (u - pLeft) / (1.0 - pLeft);
+            current = right;
+        }
+    }
+
+    light = d_nodes[current].offset;
+    return true;
+}
+
+#endif
@@ -1,44 +1,73 @@
 #include "raytracer.h"
 
+#include <cstdio>
 #include <iostream>
 #include <string>
+#include <vector>
 
 using namespace std;
 
 int main(int argc, char *argv[])
 {
+    // --size WIDTHxHEIGHT may appear anywhere, the rest are file names
+    vector<string> files;
+    unsigned width = 0;
+    unsigned height = 0;
+    bool badArgs = false;
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        string arg = argv[idx];
+        if (arg != "--size")
+            files.push_back(arg);
+        else if (idx + 1 == argc
+                 or sscanf(argv[++idx], "%ux%u", &width, &height) != 2
+                 or width == 0 or height == 0)
+            badArgs = true;
+    }
+
+    // Raw pixels on stdout leave the messages to stderr.
+    if (files.size() == 2 && files[1] == "-")
+        cout.rdbuf(cerr.rdbuf());
+
     cout << "Computer Graphics - Ray tracer\n\n";
 
-    if (argc < 2 || argc > 3)
+    if (badArgs || files.size() < 1 || files.size() > 2)
     {
-        cerr << "Usage: " << argv[0] << " in-file [out-file.png]\n";
+        cerr << "Usage: " << argv[0]
+             << " in-file [out-file] [--size WIDTHxHEIGHT]\n"
+             << "out-file: .png, .ppm, .pfm, .rgb or .raw, or - for raw RGB"
+                " on stdout\n";
         return 1;
     }
 
     Raytracer raytracer;
 
     // read the scene
-    if (!raytracer.readScene(argv[1]))
+    if (!raytracer.readScene(files[0]))
     {
-        cerr << "Error: reading scene from " << argv[1] <<
+        cerr << "Error: reading scene from " << files[0] <<
             " failed - no output generated.\n";
         return 1;
     }
 
+    if (width != 0)
+        raytracer.setSize(width, height);
+
     // determine output name
     string ofname;
-    if (argc >= 3)
+    if (files.size() >= 2)
     {
-        ofname = argv[2];   // use the provided name
+        ofname = files[1];  // use the provided name
     }
     else
     {
-        ofname = argv[1];   // replace .json with .png
+        ofname = files[0];  // replace .json with .png
         ofname.erase(ofname.begin() + ofname.find_last_of('.'), ofname.end());
         ofname += ".png";
     }
 
-    raytracer.renderToFile(ofname);
+    if (!raytracer.renderToFile(ofname))
+        return 1;
 
     return 0;
 }
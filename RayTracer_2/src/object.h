@@ -1,6 +1,7 @@
 #ifndef OBJECT_H_
 #define OBJECT_H_
 
+#include "aabb.h"
 #include "material.h"
 
 // not really needed here, but deriving classes may need them
@@ -8,10 +9,6 @@
 #include "ray.h"
 #include "triple.h"
 
-#include <memory>
-class Object;
-typedef std::shared_ptr<Object> ObjectPtr;
-
 class Object
 {
     public:
@@ -19,14 +16,26 @@ class Object
 
         virtual ~Object() = default;
 
-        virtual Hit intersect(Ray const &ray) = 0;  // must be implemented
-                                                    // in derived class
-
-        virtual Vector toUV(Point const &hit)
+        // Implementations must not modify the object: the renderer calls
+        // these concurrently from several threads.
+        // Only hits within [ray.tMin, ray.tMax] may be returned. Only the
+        // distance and the shape's (u, v) payload are set: most candidates
+        // are discarded, so the normal is left to finalize().
+        virtual Hit intersect(Ray const &ray) const = 0;    // must be implemented
+                                                            // in derived class
+
+        // Complete a hit returned by intersect(ray) for shading: set the
+        // normal and, if the material is textured, the texture coordinates.
+        virtual void finalize(Ray const &ray, Hit &hit) const = 0;
+
+        // Is there any hit within [ray.tMin, ray.tMax]? Used for shadow rays,
+        // so shapes should override it to stop early and skip the normal.
+        virtual bool occluded(Ray const &ray) const
         {
-            // bogus implementation
-            return Vector{};
+            return ray.inRange(intersect(ray).t);
         }
+
+        virtual AABB boundingBox() const = 0;       // used to build the BVH
 };
 
 #endif
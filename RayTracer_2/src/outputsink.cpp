@@ -0,0 +1,391 @@
+#include "outputsink.h"
+
+#include "deflate.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+namespace
+{
+    // As Image::write_png converts a channel
+    unsigned char toByte(double value)
+    {
+        return static_cast<unsigned char>(value * 255.0);
+    }
+
+    void toBytes(Color const *pixels, unsigned width, unsigned char *bytes)
+    {
+        for (size_t idx = 0; idx != 3 * size_t(width); ++idx)
+            bytes[idx] = toByte(pixels[idx / 3].data[idx % 3]);
+    }
+
+    void putBigEndian(vector<unsigned char> &bytes, uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            bytes.push_back((value >> shift) & 0xff);
+    }
+
+    uint32_t crc32(uint32_t crc, unsigned char const *data, size_t size)
+    {
+        static vector<uint32_t> const table = []()
+        {
+            vector<uint32_t> entries(256);
+            for (uint32_t byte = 0; byte != 256; ++byte)
+            {
+                uint32_t value = byte;
+                for (unsigned bit = 0; bit != 8; ++bit)
+                    value = value & 1 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+                entries[byte] = value;
+            }
+            return entries;
+        }();
+
+        crc = ~crc;
+        for (size_t idx = 0; idx != size; ++idx)
+            crc = table[(crc ^ data[idx]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    // The PNG predictor of a byte from those to its left (a), above (b)
+    // and above left (c)
+    unsigned char paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = abs(p - a);
+        int pb = abs(p - b);
+        int pc = abs(p - c);
+        if (pa <= pb and pa <= pc)
+            return a;
+        return pb <= pc ? b : c;
+    }
+
+    // Filters the size bytes of row, below prev, into line: the filter
+    // type and the filtered bytes. Every filter is tried, and the one whose
+    // bytes (as signed values) add up to the least is kept, the usual
+    // guess at what compresses best.
+    void filterRow(unsigned char const *row, unsigned char const *prev,
+                   size_t size, unsigned char *line)
+    {
+        vector<unsigned char> filtered(size);
+        unsigned long bestSum = ~0ul;
+        for (unsigned char type = 0; type != 5; ++type)
+        {
+            unsigned long sum = 0;
+            for (size_t idx = 0; idx != size; ++idx)
+            {
+                int left = idx >= 3 ? row[idx - 3] : 0;
+                int upLeft = idx >= 3 ? prev[idx - 3] : 0;
+                int predicted = type == 0 ? 0
+                              : type == 1 ? left
+                              : type == 2 ? prev[idx]
+                              : type == 3 ? (left + prev[idx]) / 2
+                              : paeth(left, prev[idx], upLeft);
+                filtered[idx] = row[idx] - predicted;
+                sum += abs(static_cast<signed char>(filtered[idx]));
+            }
+            if (sum < bestSum)
+            {
+                bestSum = sum;
+                line[0] = type;
+                copy(filtered.begin(), filtered.end(), line + 1);
+            }
+        }
+    }
+
+    // A PNG chunk of the given type, with room for its data after it
+    vector<unsigned char> startChunk(char const *type)
+    {
+        vector<unsigned char> chunk(8);     // the length, once known
+        copy(type, type + 4, chunk.begin() + 4);
+        return chunk;
+    }
+
+    // fill in the length and append the CRC of a chunk from startChunk()
+    void endChunk(vector<unsigned char> &chunk)
+    {
+        vector<unsigned char> length;
+        putBigEndian(length, chunk.size() - 8);
+        copy(length.begin(), length.end(), chunk.begin());
+        putBigEndian(chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+    }
+}
+
+// --- FileSink ----------------------------------------------------------------
+
+FileSink::FileSink(string const &filename)
+:
+    d_filename(filename)
+{}
+
+FileSink::~FileSink()
+{
+    if (d_file and d_file != stdout)
+        fclose(d_file);
+}
+
+void FileSink::open()
+{
+    d_file = d_filename == "-" ? stdout : fopen(d_filename.c_str(), "wb");
+    d_failed = d_file == nullptr;
+}
+
+void FileSink::write(void const *data, size_t size)
+{
+    if (d_file and size != 0 and fwrite(data, 1, size, d_file) != size)
+        d_failed = true;
+}
+
+void FileSink::seek(uint64_t offset)
+{
+    if (d_file and fseeko(d_file, offset, SEEK_SET) != 0)
+        d_failed = true;
+}
+
+void FileSink::flush()
+{
+    if (d_file and fflush(d_file) != 0)
+        d_failed = true;
+}
+
+bool FileSink::end()
+{
+    if (d_file)
+    {
+        bool closed = d_file == stdout ? fflush(d_file) == 0
+                                       : fclose(d_file) == 0;
+        d_failed = d_failed or not closed;
+        d_file = nullptr;
+    }
+    return not d_failed;
+}
+
+// --- PngSink -----------------------------------------------------------------
+
+PngSink::PngSink(string const &filename, int level, unsigned numThreads)
+:
+    FileSink(filename),
+    d_level(level),
+    d_pool(numThreads)
+{}
+
+void PngSink::begin(unsigned width, unsigned height)
+{
+    open();
+    unsigned char const signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26,
+                                        '\n'};
+    write(signature, sizeof(signature));
+
+    // 8 bits per channel, RGB, no interlacing
+    vector<unsigned char> header = startChunk("IHDR");
+    putBigEndian(header, width);
+    putBigEndian(header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    endChunk(header);
+    write(header.data(), header.size());
+
+    d_width = width;
+    d_previous.assign(3 * size_t(width), 0);
+}
+
+void PngSink::writeRow(Color const *pixels)
+{
+    size_t size = d_rows.size();
+    d_rows.resize(size + 3 * size_t(d_width));
+    toBytes(pixels, d_width, &d_rows[size]);
+    if (d_rows.size() >= CHUNK_BYTES * d_pool.size())
+        compressRows(false);
+}
+
+void PngSink::flush()
+{
+    compressRows(false);
+    FileSink::flush();
+}
+
+bool PngSink::end()
+{
+    compressRows(true);
+    vector<unsigned char> trailer = startChunk("IEND");
+    endChunk(trailer);
+    write(trailer.data(), trailer.size());
+    return FileSink::end();
+}
+
+void PngSink::compressRows(bool last)
+{
+    size_t rowBytes = 3 * size_t(d_width);
+    size_t numRows = d_rows.size() / rowBytes;
+    if (numRows == 0 and not last)
+        return;
+
+    size_t rowsPerChunk = max<size_t>(1, CHUNK_BYTES / rowBytes);
+    unsigned numChunks = max<size_t>(1, (numRows + rowsPerChunk - 1)
+                                        / rowsPerChunk);
+
+    // A row is filtered against the unfiltered row above it, so all chunks
+    // can be filtered at once. Stored rows are not filtered: it would not
+    // make them any smaller.
+    vector<vector<unsigned char>> lines(numChunks);
+    d_pool.parallelFor(numChunks, [&](unsigned chunk, unsigned)
+    {
+        size_t first = chunk * rowsPerChunk;
+        size_t end = min(numRows, first + rowsPerChunk);
+        lines[chunk].resize((end - first) * (rowBytes + 1));
+        for (size_t row = first; row < end; ++row)
+        {
+            unsigned char const *bytes = &d_rows[row * rowBytes];
+            unsigned char *line = &lines[chunk][(row - first) * (rowBytes + 1)];
+            if (d_level <= 0)
+            {
+                line[0] = 0;
+                copy(bytes, bytes + rowBytes, line + 1);
+            }
+            else
+                filterRow(bytes,
+                          row == 0 ? d_previous.data() : bytes - rowBytes,
+                          rowBytes, line);
+        }
+    });
+
+    // Then each is compressed into an IDAT chunk of its own. Only the last
+    // one of the image ends the stream; the others end with a sync flush.
+    vector<vector<unsigned char>> chunks(numChunks);
+    vector<uint32_t> adlers(numChunks);
+    d_pool.parallelFor(numChunks, [&](unsigned chunk, unsigned)
+    {
+        vector<unsigned char> const &input = lines[chunk];
+        vector<unsigned char> const &before =
+            chunk == 0 ? d_history : lines[chunk - 1];
+        vector<unsigned char> &output = chunks[chunk];
+
+        output = startChunk("IDAT");
+        if (chunk == 0 and not d_started)
+        {
+            // The zlib header: deflate with a 32 kB window, and the level
+            unsigned char flags = d_level <= 0 ? 0x01 : d_level < 6 ? 0x5e
+                                  : d_level == 6 ? 0x9c : 0xda;
+            output.insert(output.end(), {0x78, flags});
+        }
+
+        Deflater deflater(d_level);
+        deflater.setDictionary(before.data(), before.size());
+        deflater.write(input.data(), input.size(), output);
+        bool final = last and chunk + 1 == numChunks;
+        if (final)
+            deflater.finish(output);
+        else
+        {
+            deflater.flush(output);
+            endChunk(output);
+        }
+        adlers[chunk] = adler32(1, input.data(), input.size());
+    });
+    d_started = true;
+
+    // The checksum of the whole stream follows the last chunk.
+    for (unsigned chunk = 0; chunk != numChunks; ++chunk)
+        d_adler = adler32Combine(d_adler, adlers[chunk], lines[chunk].size());
+    if (last)
+    {
+        putBigEndian(chunks.back(), d_adler);
+        endChunk(chunks.back());
+    }
+    for (vector<unsigned char> const &chunk : chunks)
+        write(chunk.data(), chunk.size());
+
+    // Keep what the next rows need: the last row, and the last 32 kB
+    // compressed to start the next chunk from.
+    size_t const WINDOW_SIZE = 32768;
+    for (vector<unsigned char> const &input : lines)
+    {
+        size_t skip = input.size() > WINDOW_SIZE
+                      ? input.size() - WINDOW_SIZE : 0;
+        d_history.insert(d_history.end(), input.begin() + skip, input.end());
+    }
+    if (d_history.size() > WINDOW_SIZE)
+        d_history.erase(d_history.begin(),
+                        d_history.end() - WINDOW_SIZE);
+    if (numRows != 0)
+        d_previous.assign(d_rows.end() - rowBytes, d_rows.end());
+    d_rows.clear();
+}
+
+// --- PpmSink -----------------------------------------------------------------
+
+void PpmSink::begin(unsigned width, unsigned height)
+{
+    open();
+    string header = "P6\n" + to_string(width) + ' ' + to_string(height)
+                    + "\n255\n";
+    write(header.data(), header.size());
+    d_row.resize(3 * width);
+}
+
+void PpmSink::writeRow(Color const *pixels)
+{
+    toBytes(pixels, d_row.size() / 3, d_row.data());
+    write(d_row.data(), d_row.size());
+}
+
+// --- PfmSink -----------------------------------------------------------------
+
+void PfmSink::begin(unsigned width, unsigned height)
+{
+    open();
+
+    // A negative scale means little endian.
+    uint16_t const one = 1;
+    bool littleEndian = *reinterpret_cast<unsigned char const *>(&one) == 1;
+    string header = "PF\n" + to_string(width) + ' ' + to_string(height)
+                    + (littleEndian ? "\n-1.0\n" : "\n1.0\n");
+    write(header.data(), header.size());
+    d_headerSize = header.size();
+    d_height = height;
+    d_values.resize(3 * width);
+}
+
+void PfmSink::writeRow(Color const *pixels)
+{
+    for (size_t idx = 0; idx != d_values.size(); ++idx)
+        d_values[idx] = pixels[idx / 3].data[idx % 3];
+
+    uint64_t rowBytes = d_values.size() * sizeof(float);
+    seek(d_headerSize + (d_height - 1 - d_row) * rowBytes);
+    write(d_values.data(), rowBytes);
+    ++d_row;
+}
+
+// --- RawSink -----------------------------------------------------------------
+
+void RawSink::begin(unsigned width, unsigned height)
+{
+    open();
+    d_row.resize(3 * width);
+}
+
+void RawSink::writeRow(Color const *pixels)
+{
+    toBytes(pixels, d_row.size() / 3, d_row.data());
+    write(d_row.data(), d_row.size());
+}
+
+unique_ptr<OutputSink> makeSink(string const &filename, int level,
+                                unsigned numThreads)
+{
+    if (filename == "-")
+        return unique_ptr<OutputSink>(new RawSink(filename));
+
+    size_t dot = filename.find_last_of('.');
+    string extension = dot == string::npos ? "" : filename.substr(dot);
+    transform(extension.begin(), extension.end(), extension.begin(),
+              ::tolower);
+    if (extension == ".ppm")
+        return unique_ptr<OutputSink>(new PpmSink(filename));
+    if (extension == ".pfm")
+        return unique_ptr<OutputSink>(new PfmSink(filename));
+    if (extension == ".rgb" or extension == ".raw")
+        return unique_ptr<OutputSink>(new RawSink(filename));
+    return unique_ptr<OutputSink>(new PngSink(filename, level, numThreads));
+}
@@ -0,0 +1,136 @@
+
+#ifndef OUTPUTSINK_H_
+#define OUTPUTSINK_H_
+
+#include "threadpool.h"
+#include "triple.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Where a rendered image goes, one row at a time from the top, so it can
+// be written (and read by whatever comes next) while the rest is still
+// being rendered. Nothing is opened before the first row.
+class OutputSink
+{
+    public:
+        virtual ~OutputSink() = default;
+
+        // start an image of width x height pixels
+        virtual void begin(unsigned width, unsigned height) = 0;
+
+        // the next row, width pixels
+        virtual void writeRow(Color const *pixels) = 0;
+
+        // pass on the rows so far, which may be buffered until now
+        virtual void flush() = 0;
+
+        // end the image, returns whether all of it was written
+        virtual bool end() = 0;
+};
+
+// A sink writing to a file, or to stdout for the name "-"
+class FileSink: public OutputSink
+{
+    std::string d_filename;
+    FILE *d_file = nullptr;
+    bool d_failed = false;
+
+    public:
+        explicit FileSink(std::string const &filename);
+        ~FileSink() override;
+
+        void flush() override;
+        bool end() override;
+
+    protected:
+        // opens the file; the other functions do nothing after a failure
+        void open();
+        void write(void const *data, size_t size);
+        void seek(uint64_t offset);
+};
+
+// PNG, 8 bit RGB. Every row gets the filter that makes it smallest. The
+// rows are compressed in chunks of about CHUNK_BYTES, as many at a time as
+// the sink has threads: each chunk on its own, starting from the last
+// 32 kB of the one before it, and ending on a byte boundary so the chunks
+// simply follow each other in the stream. Level 0 only stores the rows,
+// which is fastest; 1 compresses fast, 9 best.
+class PngSink: public FileSink
+{
+    static size_t const CHUNK_BYTES = 1 << 18;
+
+    unsigned d_width = 0;
+    int d_level;
+    ThreadPool d_pool;
+    bool d_started = false;             // the zlib header was written
+    uint32_t d_adler = 1;
+    std::vector<unsigned char> d_rows;      // not yet compressed, unfiltered
+    std::vector<unsigned char> d_previous;  // the row before them
+    std::vector<unsigned char> d_history;   // the last 32 kB compressed
+
+    public:
+        // numThreads == 0 selects the number of hardware threads
+        explicit PngSink(std::string const &filename, int level = 6,
+                         unsigned numThreads = 0);
+
+        void begin(unsigned width, unsigned height) override;
+        void writeRow(Color const *pixels) override;
+        void flush() override;
+        bool end() override;
+
+    private:
+        // compress and write the rows so far, ending the stream if last
+        void compressRows(bool last);
+};
+
+// Binary PPM (P6), 8 bits per channel
+class PpmSink: public FileSink
+{
+    std::vector<unsigned char> d_row;
+
+    public:
+        using FileSink::FileSink;
+
+        void begin(unsigned width, unsigned height) override;
+        void writeRow(Color const *pixels) override;
+};
+
+// PFM: 32 bit floats, the colors as rendered. PFM stores the rows bottom
+// to top, so the file must allow seeking (it cannot be a pipe).
+class PfmSink: public FileSink
+{
+    unsigned d_height = 0;
+    unsigned d_row = 0;             // rows written
+    uint64_t d_headerSize = 0;
+    std::vector<float> d_values;
+
+    public:
+        using FileSink::FileSink;
+
+        void begin(unsigned width, unsigned height) override;
+        void writeRow(Color const *pixels) override;
+};
+
+// Nothing but the bytes of the rows, 8 bit RGB: for pipes and stdout
+class RawSink: public FileSink
+{
+    std::vector<unsigned char> d_row;
+
+    public:
+        using FileSink::FileSink;
+
+        void begin(unsigned width, unsigned height) override;
+        void writeRow(Color const *pixels) override;
+};
+
+// The sink for filename, by its extension: .ppm, .pfm, .rgb or .raw, and
+// PNG (compressed at level with numThreads) for anything else. "-" writes
+// raw RGB to stdout.
+std::unique_ptr<OutputSink> makeSink(std::string const &filename,
+                                     int level = 6, unsigned numThreads = 0);
+
+#endif
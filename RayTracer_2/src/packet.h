@@ -0,0 +1,88 @@
+
+#ifndef PACKET_H_
+#define PACKET_H_
+
+#include "ray.h"
+#include "simd.h"
+
+#include <limits>
+
+// Up to MAX_SIZE rays traced together, stored per component so
+// consecutive rays fill the lanes of the SIMD registers (see simd.h).
+// Lanes beyond size() hold an empty ray (tMin > tMax), which hits nothing.
+class RayPacket
+{
+    public:
+        static unsigned const MAX_SIZE = 16;
+
+        double ox[MAX_SIZE];    // origins
+        double oy[MAX_SIZE];
+        double oz[MAX_SIZE];
+        double dx[MAX_SIZE];    // directions
+        double dy[MAX_SIZE];
+        double dz[MAX_SIZE];
+        double invDx[MAX_SIZE]; // reciprocal directions, for the BVH
+        double invDy[MAX_SIZE];
+        double invDz[MAX_SIZE];
+        double tMin[MAX_SIZE];
+        double tMax[MAX_SIZE];
+
+        RayPacket()
+        :
+            d_size(0)
+        {
+            for (unsigned lane = 0; lane != MAX_SIZE; ++lane)
+                set(lane, Ray(Point(), Vector(0.0, 0.0, 1.0),
+                              std::numeric_limits<double>::infinity(),
+                              -std::numeric_limits<double>::infinity()));
+        }
+
+        unsigned size() const
+        {
+            return d_size;
+        }
+
+        bool full() const
+        {
+            return d_size == MAX_SIZE;
+        }
+
+        // Number of SIMD registers needed to cover the rays in use
+        unsigned numChunks() const
+        {
+            return (d_size + simd::WIDTH - 1) / simd::WIDTH;
+        }
+
+        void add(Ray const &ray)
+        {
+            set(d_size++, ray);
+        }
+
+        // The ray in the given lane, with its current interval
+        Ray ray(unsigned lane) const
+        {
+            return Ray(Point(ox[lane], oy[lane], oz[lane]),
+                       Vector(dx[lane], dy[lane], dz[lane]),
+                       tMin[lane], tMax[lane]);
+        }
+
+    private:
+        unsigned d_size;
+
+        void set(unsigned lane, Ray const &ray)
+        {
+            ox[lane] = ray.O.x;
+            oy[lane] = ray.O.y;
+            oz[lane] = ray.O.z;
+            dx[lane] = ray.D.x;
+            dy[lane] = ray.D.y;
+            dz[lane] = ray.D.z;
+            invDx[lane] = 1.0 / ray.D.x;
+            invDy[lane] = 1.0 / ray.D.y;
+            invDz[lane] = 1.0 / ray.D.z;
+            tMin[lane] = ray.tMin;
+            tMax[lane] = ray.tMax;
+        }
+};
+
+#endif
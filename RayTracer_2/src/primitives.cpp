@@ -0,0 +1,497 @@
+#include "primitives.h"
+
+#include "shapes/quad.h"
+#include "shapes/sphere.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+// The kernels below compute exactly the same expressions, in the same order,
+// as Sphere::intersect and Quad::intersect, so the images do not depend on
+// which path is taken. They are kept free of early exits so the loops over
+// a leaf vectorize.
+
+namespace
+{
+    double const NaN = numeric_limits<double>::quiet_NaN();
+
+    // Reorder values in place to the order of the BVH.
+    template <typename Type>
+    void reorder(vector<Type> &values, vector<unsigned> const &order)
+    {
+        vector<Type> sorted;
+        sorted.reserve(order.size());
+        for (unsigned idx : order)
+            sorted.push_back(values[idx]);
+        values.swap(sorted);
+    }
+
+    // Initial distances to beat for the rays of a packet. Unused lanes
+    // never hit, their value does not matter.
+    void closestDistances(RayPacket const &packet, HitRecord const *closest,
+                          double *best)
+    {
+        double const inf = numeric_limits<double>::infinity();
+        for (unsigned lane = 0; lane != RayPacket::MAX_SIZE; ++lane)
+            best[lane] = lane < packet.size() ? closest[lane].hit.t : inf;
+    }
+}
+
+HitRecord::HitRecord()
+:
+    hit(numeric_limits<double>::infinity()),
+    obj(nullptr)
+{}
+
+// --- Spheres -----------------------------------------------------------------
+
+void SphereSet::build(vector<Sphere const *> const &spheres)
+{
+    vector<AABB> boxes;
+    boxes.reserve(spheres.size());
+    for (Sphere const *sphere : spheres)
+        boxes.push_back(sphere->boundingBox());
+    d_bvh.build(boxes, MAX_LEAF_SIZE);
+
+    d_cx.clear();
+    d_cy.clear();
+    d_cz.clear();
+    d_r2.clear();
+    d_objects.clear();
+    for (unsigned idx : d_bvh.order())
+    {
+        Sphere const &sphere = *spheres[idx];
+        d_cx.push_back(sphere.position.x);
+        d_cy.push_back(sphere.position.y);
+        d_cz.push_back(sphere.position.z);
+        d_r2.push_back(sphere.r * sphere.r);
+        d_objects.push_back(&sphere);
+    }
+}
+
+unsigned SphereSet::size() const
+{
+    return d_objects.size();
+}
+
+// t[i] becomes the first root of sphere first + i within the ray's
+// interval, or NaN if there is none.
+void SphereSet::leafDistances(Ray const &ray, unsigned first, unsigned count,
+                              double *t) const
+{
+    double const a = ray.D.dot(ray.D);
+    double const *cx = &d_cx[first];
+    double const *cy = &d_cy[first];
+    double const *cz = &d_cz[first];
+    double const *r2 = &d_r2[first];
+
+    for (unsigned idx = 0; idx < count; ++idx)
+    {
+        double Lx = ray.O.x - cx[idx];
+        double Ly = ray.O.y - cy[idx];
+        double Lz = ray.O.z - cz[idx];
+        double b = 2.0 * (ray.D.x * Lx + ray.D.y * Ly + ray.D.z * Lz);
+        double c = (Lx * Lx + Ly * Ly + Lz * Lz) - r2[idx];
+
+        // Solvers::quadratic
+        double discr = b * b - 4.0 * a * c;
+        double root = sqrt(max(discr, 0.0));
+        double q = (b > 0.0) ? -0.5 * (b + root) : -0.5 * (b - root);
+        double x0 = discr == 0.0 ? -0.5 * b / a : q / a;
+        double x1 = discr == 0.0 ? -0.5 * b / a : c / q;
+        double t0 = min(x0, x1);
+        double t1 = max(x0, x1);
+
+        double hit = ray.inRange(t0) ? t0 : (ray.inRange(t1) ? t1 : NaN);
+        t[idx] = discr < 0.0 ? NaN : hit;
+    }
+}
+
+void SphereSet::intersect(Ray &ray, HitRecord &closest) const
+{
+    d_bvh.traverse(ray, [&](unsigned first, unsigned count)
+    {
+        double t[MAX_LEAF_SIZE];
+        leafDistances(ray, first, count, t);
+        for (unsigned idx = 0; idx != count; ++idx)
+            if (t[idx] < closest.hit.t)
+            {
+                closest.hit = Hit(t[idx]);
+                closest.obj = d_objects[first + idx];
+                ray.tMax = t[idx];
+            }
+        return false;
+    });
+}
+
+Object const *SphereSet::occluder(Ray const &ray) const
+{
+    Object const *blocker = nullptr;
+    Ray shadow(ray);
+    d_bvh.traverse(shadow, [&](unsigned first, unsigned count)
+    {
+        double t[MAX_LEAF_SIZE];
+        leafDistances(shadow, first, count, t);
+        for (unsigned idx = 0; idx != count; ++idx)
+            if (not std::isnan(t[idx]))
+            {
+                blocker = d_objects[first + idx];
+                return true;
+            }
+        return false;
+    });
+    return blocker;
+}
+
+void SphereSet::intersect(RayPacket &packet, HitRecord *closest) const
+{
+    using namespace simd;
+
+    double best[RayPacket::MAX_SIZE];
+    closestDistances(packet, closest, best);
+
+    d_bvh.traverse(packet, [&](unsigned first, unsigned count)
+    {
+        for (unsigned idx = first; idx != first + count; ++idx)
+        {
+            Lanes const cx = broadcast(d_cx[idx]);
+            Lanes const cy = broadcast(d_cy[idx]);
+            Lanes const cz = broadcast(d_cz[idx]);
+            Lanes const r2 = broadcast(d_r2[idx]);
+
+            for (unsigned chunk = 0; chunk != packet.numChunks(); ++chunk)
+            {
+                unsigned base = chunk * WIDTH;
+                Lanes Dx = load(packet.dx + base);
+                Lanes Dy = load(packet.dy + base);
+                Lanes Dz = load(packet.dz + base);
+                Lanes tMin = load(packet.tMin + base);
+                Lanes tMax = load(packet.tMax + base);
+
+                // As leafDistances, with the rays in the lanes.
+                Lanes a = Dx * Dx + Dy * Dy + Dz * Dz;
+                Lanes Lx = load(packet.ox + base) - cx;
+                Lanes Ly = load(packet.oy + base) - cy;
+                Lanes Lz = load(packet.oz + base) - cz;
+                Lanes b = broadcast(2.0) * (Dx * Lx + Dy * Ly + Dz * Lz);
+                Lanes c = (Lx * Lx + Ly * Ly + Lz * Lz) - r2;
+
+                Lanes discr = b * b - broadcast(4.0) * a * c;
+                Lanes root = simd::sqrt(simd::max(discr, broadcast(0.0)));
+                Lanes q = select(b > broadcast(0.0),
+                                 broadcast(-0.5) * (b + root),
+                                 broadcast(-0.5) * (b - root));
+                Mask single = discr == broadcast(0.0);
+                Lanes x0 = select(single, broadcast(-0.5) * b / a, q / a);
+                Lanes x1 = select(single, broadcast(-0.5) * b / a, c / q);
+                Lanes t0 = simd::min(x0, x1);
+                Lanes t1 = simd::max(x0, x1);
+
+                Lanes nan = broadcast(NaN);
+                Mask inRange0 = (tMin <= t0) & (t0 <= tMax);
+                Mask inRange1 = (tMin <= t1) & (t1 <= tMax);
+                Lanes hit = select(inRange0, t0, select(inRange1, t1, nan));
+                Lanes t = select(discr < broadcast(0.0), nan, hit);
+
+                unsigned hits = bits(t < load(best + base));
+                if (hits == 0)
+                    continue;
+
+                double dist[WIDTH];
+                store(dist, t);
+                for (unsigned lane = 0; lane != WIDTH; ++lane)
+                    if (hits & (1u << lane))
+                    {
+                        best[base + lane] = dist[lane];
+                        packet.tMax[base + lane] = dist[lane];
+                        closest[base + lane].hit = Hit(dist[lane]);
+                        closest[base + lane].obj = d_objects[idx];
+                    }
+            }
+        }
+        return false;
+    });
+}
+
+// --- Quads -------------------------------------------------------------------
+
+void QuadSet::build(vector<Quad const *> const &quads)
+{
+    vector<AABB> boxes;
+    boxes.reserve(quads.size());
+    for (Quad const *quad : quads)
+        boxes.push_back(quad->boundingBox());
+    d_bvh.build(boxes, MAX_LEAF_SIZE);
+
+    for (auto *values : {&d_ox, &d_oy, &d_oz, &d_ax, &d_ay, &d_az,
+                         &d_bx, &d_by, &d_bz, &d_nx, &d_ny, &d_nz,
+                         &d_aLen2, &d_bLen2})
+        values->clear();
+    d_objects.clear();
+
+    for (unsigned idx : d_bvh.order())
+    {
+        Quad const &quad = *quads[idx];
+        Vector edgeA = quad.v1 - quad.v0;
+        Vector edgeB = quad.v3 - quad.v0;
+        d_ox.push_back(quad.v0.x);
+        d_oy.push_back(quad.v0.y);
+        d_oz.push_back(quad.v0.z);
+        d_ax.push_back(edgeA.x);
+        d_ay.push_back(edgeA.y);
+        d_az.push_back(edgeA.z);
+        d_bx.push_back(edgeB.x);
+        d_by.push_back(edgeB.y);
+        d_bz.push_back(edgeB.z);
+        d_nx.push_back(quad.N.x);
+        d_ny.push_back(quad.N.y);
+        d_nz.push_back(quad.N.z);
+        d_aLen2.push_back(edgeA.length_2());
+        d_bLen2.push_back(edgeB.length_2());
+        d_objects.push_back(&quad);
+    }
+}
+
+unsigned QuadSet::size() const
+{
+    return d_objects.size();
+}
+
+void QuadSet::leafDistances(Ray const &ray, unsigned first, unsigned count,
+                            double *t, double *u, double *v) const
+{
+    double const eps = numeric_limits<double>::epsilon();
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        unsigned idx = first + i;
+        double nx = d_nx[idx];
+        double ny = d_ny[idx];
+        double nz = d_nz[idx];
+
+        // Parallel to the plane: no intersection.
+        double DdotN = (-ray.D.x) * nx + (-ray.D.y) * ny + (-ray.D.z) * nz;
+        bool parallel = abs(DdotN) < eps;
+
+        double dist = -(nx * (ray.O.x - d_ox[idx]) +
+                        ny * (ray.O.y - d_oy[idx]) +
+                        nz * (ray.O.z - d_oz[idx]))
+                    / (nx * ray.D.x + ny * ray.D.y + nz * ray.D.z);
+
+        // Coordinates of the hit relative to the corner, along both edges.
+        double px = (ray.O.x + dist * ray.D.x) - d_ox[idx];
+        double py = (ray.O.y + dist * ray.D.y) - d_oy[idx];
+        double pz = (ray.O.z + dist * ray.D.z) - d_oz[idx];
+        double hu = px * d_ax[idx] + py * d_ay[idx] + pz * d_az[idx];
+        double hv = px * d_bx[idx] + py * d_by[idx] + pz * d_bz[idx];
+
+        bool inside = 0.0 <= hu and hu <= d_aLen2[idx] and
+                      0.0 <= hv and hv <= d_bLen2[idx];
+
+        t[i] = (not parallel and ray.inRange(dist) and inside) ? dist : NaN;
+        u[i] = hu;
+        v[i] = hv;
+    }
+}
+
+void QuadSet::intersect(Ray &ray, HitRecord &closest) const
+{
+    d_bvh.traverse(ray, [&](unsigned first, unsigned count)
+    {
+        double t[MAX_LEAF_SIZE];
+        double u[MAX_LEAF_SIZE];
+        double v[MAX_LEAF_SIZE];
+        leafDistances(ray, first, count, t, u, v);
+        for (unsigned idx = 0; idx != count; ++idx)
+            if (t[idx] < closest.hit.t)
+            {
+                // Same (u, v) payload as Quad::intersect
+                closest.hit = Hit(t[idx], u[idx] / d_aLen2[first + idx],
+                                  v[idx] / d_bLen2[first + idx]);
+                closest.obj = d_objects[first + idx];
+                ray.tMax = t[idx];
+            }
+        return false;
+    });
+}
+
+Object const *QuadSet::occluder(Ray const &ray) const
+{
+    Object const *blocker = nullptr;
+    Ray shadow(ray);
+    d_bvh.traverse(shadow, [&](unsigned first, unsigned count)
+    {
+        double t[MAX_LEAF_SIZE];
+        double u[MAX_LEAF_SIZE];
+        double v[MAX_LEAF_SIZE];
+        leafDistances(shadow, first, count, t, u, v);
+        for (unsigned idx = 0; idx != count; ++idx)
+            if (not std::isnan(t[idx]))
+            {
+                blocker = d_objects[first + idx];
+                return true;
+            }
+        return false;
+    });
+    return blocker;
+}
+
+void QuadSet::intersect(RayPacket &packet, HitRecord *closest) const
+{
+    using namespace simd;
+
+    double best[RayPacket::MAX_SIZE];
+    closestDistances(packet, closest, best);
+
+    Lanes const eps = broadcast(numeric_limits<double>::epsilon());
+
+    d_bvh.traverse(packet, [&](unsigned first, unsigned count)
+    {
+        for (unsigned idx = first; idx != first + count; ++idx)
+        {
+            Lanes const nx = broadcast(d_nx[idx]);
+            Lanes const ny = broadcast(d_ny[idx]);
+            Lanes const nz = broadcast(d_nz[idx]);
+            Lanes const ox = broadcast(d_ox[idx]);
+            Lanes const oy = broadcast(d_oy[idx]);
+            Lanes const oz = broadcast(d_oz[idx]);
+            Lanes const aLen2 = broadcast(d_aLen2[idx]);
+            Lanes const bLen2 = broadcast(d_bLen2[idx]);
+            Lanes const zero = broadcast(0.0);
+
+            for (unsigned chunk = 0; chunk != packet.numChunks(); ++chunk)
+            {
+                unsigned base = chunk * WIDTH;
+                Lanes Ox = load(packet.ox + base);
+                Lanes Oy = load(packet.oy + base);
+                Lanes Oz = load(packet.oz + base);
+                Lanes Dx = load(packet.dx + base);
+                Lanes Dy = load(packet.dy + base);
+                Lanes Dz = load(packet.dz + base);
+                Lanes tMin = load(packet.tMin + base);
+                Lanes tMax = load(packet.tMax + base);
+
+                // As leafDistances, with the rays in the lanes.
+                Lanes DdotN = (-Dx) * nx + (-Dy) * ny + (-Dz) * nz;
+                Mask parallel = simd::abs(DdotN) < eps;
+
+                Lanes dist = -(nx * (Ox - ox) + ny * (Oy - oy) +
+                               nz * (Oz - oz))
+                           / (nx * Dx + ny * Dy + nz * Dz);
+
+                Lanes px = (Ox + dist * Dx) - ox;
+                Lanes py = (Oy + dist * Dy) - oy;
+                Lanes pz = (Oz + dist * Dz) - oz;
+                Lanes hu = px * broadcast(d_ax[idx]) + py * broadcast(d_ay[idx])
+                         + pz * broadcast(d_az[idx]);
+                Lanes hv = px * broadcast(d_bx[idx]) + py * broadcast(d_by[idx])
+                         + pz * broadcast(d_bz[idx]);
+
+                Mask inside = (zero <= hu) & (hu <= aLen2) &
+                              (zero <= hv) & (hv <= bLen2);
+                Mask inRange = (tMin <= dist) & (dist <= tMax);
+                Mask valid = (!parallel) & inRange & inside;
+                Lanes t = select(valid, dist, broadcast(NaN));
+
+                unsigned hits = bits(t < load(best + base));
+                if (hits == 0)
+                    continue;
+
+                double dists[WIDTH];
+                double us[WIDTH];
+                double vs[WIDTH];
+                store(dists, t);
+                store(us, hu);
+                store(vs, hv);
+                for (unsigned lane = 0; lane != WIDTH; ++lane)
+                    if (hits & (1u << lane))
+                    {
+                        best[base + lane] = dists[lane];
+                        packet.tMax[base + lane] = dists[lane];
+                        closest[base + lane].hit = Hit(dists[lane],
+                                                       us[lane] / d_aLen2[idx],
+                                                       vs[lane] / d_bLen2[idx]);
+                        closest[base + lane].obj = d_objects[idx];
+                    }
+            }
+        }
+        return false;
+    });
+}
+
+// --- Other objects -----------------------------------------------------------
+
+void ObjectSet::build(vector<Object const *> const &objects)
+{
+    vector<AABB> boxes;
+    boxes.reserve(objects.size());
+    for (Object const *obj : objects)
+        boxes.push_back(obj->boundingBox());
+    d_bvh.build(boxes);
+
+    d_objects = objects;
+    reorder(d_objects, d_bvh.order());
+}
+
+unsigned ObjectSet::size() const
+{
+    return d_objects.size();
+}
+
+void ObjectSet::intersect(Ray &ray, HitRecord &closest) const
+{
+    d_bvh.traverse(ray, [&](unsigned first, unsigned count)
+    {
+        for (unsigned idx = first; idx != first + count; ++idx)
+        {
+            Hit hit(d_objects[idx]->intersect(ray));
+            if (hit.t < closest.hit.t)
+            {
+                closest.hit = hit;
+                closest.obj = d_objects[idx];
+                ray.tMax = hit.t;
+            }
+        }
+        return false;
+    });
+}
+
+Object const *ObjectSet::occluder(Ray const &ray) const
+{
+    Object const *blocker = nullptr;
+    Ray shadow(ray);
+    d_bvh.traverse(shadow, [&](unsigned first, unsigned count)
+    {
+        for (unsigned idx = first; idx != first + count; ++idx)
+            if (d_objects[idx]->occluded(shadow))
+            {
+                blocker = d_objects[idx];
+                return true;
+            }
+        return false;
+    });
+    return blocker;
+}
+
+void ObjectSet::intersect(RayPacket &packet, HitRecord *closest) const
+{
+    d_bvh.traverse(packet, [&](unsigned first, unsigned count)
+    {
+        for (unsigned idx = first; idx != first + count; ++idx)
+            for (unsigned lane = 0; lane != packet.size(); ++lane)
+            {
+                Hit hit(d_objects[idx]->intersect(packet.ray(lane)));
+                if (hit.t < closest[lane].hit.t)
+                {
+                    closest[lane].hit = hit;
+                    closest[lane].obj = d_objects[idx];
+                    packet.tMax[lane] = hit.t;
+                }
+            }
+        return false;
+    });
+}
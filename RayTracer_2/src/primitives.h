@@ -0,0 +1,121 @@
+
+#ifndef PRIMITIVES_H_
+#define PRIMITIVES_H_
+
+#include "bvh.h"
+#include "hit.h"
+#include "object.h"
+#include "packet.h"
+#include "ray.h"
+
+#include <vector>
+
+class Quad;
+class Sphere;
+
+// Render-time storage of the scene's objects, grouped by type.
+//
+// Every group keeps the data its intersection test needs as a structure of
+// arrays, sorted in the order of the group's own BVH. A BVH leaf thus refers
+// to a contiguous range of at most MAX_LEAF_SIZE primitives, which are
+// tested in a tight, non-virtual loop the compiler can vectorize. The
+// Object classes remain the user-facing description of the scene: a hit
+// reports the Object it belongs to, which is used for shading.
+
+// Closest hit found so far by a ray query.
+struct HitRecord
+{
+    Hit hit;
+    Object const *obj;
+
+    HitRecord();
+};
+
+class SphereSet
+{
+    std::vector<double> d_cx;       // centres
+    std::vector<double> d_cy;
+    std::vector<double> d_cz;
+    std::vector<double> d_r2;       // squared radii
+    std::vector<Object const *> d_objects;
+    BVH d_bvh;
+
+    public:
+        static unsigned const MAX_LEAF_SIZE = 8;
+
+        void build(std::vector<Sphere const *> const &spheres);
+
+        // Update closest if a sphere is hit before ray.tMax, and lower
+        // ray.tMax to the new closest hit.
+        void intersect(Ray &ray, HitRecord &closest) const;
+
+        // Any sphere hit within [ray.tMin, ray.tMax], nullptr if none.
+        Object const *occluder(Ray const &ray) const;
+
+        // The same for every ray of a packet: closest[lane] belongs to the
+        // ray in that lane.
+        void intersect(RayPacket &packet, HitRecord *closest) const;
+
+        unsigned size() const;
+
+    private:
+        void leafDistances(Ray const &ray, unsigned first, unsigned count,
+                           double *t) const;
+};
+
+class QuadSet
+{
+    std::vector<double> d_ox;       // first corner (v0)
+    std::vector<double> d_oy;
+    std::vector<double> d_oz;
+    std::vector<double> d_ax;       // first edge (v1 - v0)
+    std::vector<double> d_ay;
+    std::vector<double> d_az;
+    std::vector<double> d_bx;       // second edge (v3 - v0)
+    std::vector<double> d_by;
+    std::vector<double> d_bz;
+    std::vector<double> d_nx;       // normal
+    std::vector<double> d_ny;
+    std::vector<double> d_nz;
+    std::vector<double> d_aLen2;    // squared edge lengths
+    std::vector<double> d_bLen2;
+    std::vector<Object const *> d_objects;
+    BVH d_bvh;
+
+    public:
+        static unsigned const MAX_LEAF_SIZE = 8;
+
+        void build(std::vector<Quad const *> const &quads);
+
+        void intersect(Ray &ray, HitRecord &closest) const;
+        Object const *occluder(Ray const &ray) const;
+        void intersect(RayPacket &packet, HitRecord *closest) const;
+
+        unsigned size() const;
+
+    private:
+        // On a hit t[i] is set, otherwise it is NaN. u and v receive the
+        // in-quad coordinates (unnormalized).
+        void leafDistances(Ray const &ray, unsigned first, unsigned count,
+                           double *t, double *u, double *v) const;
+};
+
+// Any other shape, tested through the virtual Object interface.
+class ObjectSet
+{
+    std::vector<Object const *> d_objects;
+    BVH d_bvh;
+
+    public:
+        void build(std::vector<Object const *> const &objects);
+
+        void intersect(Ray &ray, HitRecord &closest) const;
+        Object const *occluder(Ray const &ray) const;
+
+        // Tests the rays of the packet one by one.
+        void intersect(RayPacket &packet, HitRecord *closest) const;
+
+        unsigned size() const;
+};
+
+#endif
@@ -3,18 +3,34 @@
 
 #include "triple.h"
 
+#include <limits>
+
 class Ray
 {
     public:
         Point O;        // origin
         Vector D;       // direction of the ray
 
-        Ray(Point const &from, Vector const &dir)
+        // Valid interval of the ray: only hits with tMin <= t <= tMax count.
+        // While searching for the closest hit tMax shrinks to the closest
+        // hit found so far.
+        double tMin;
+        double tMax;
+
+        Ray(Point const &from, Vector const &dir, double tMin = 0.0,
+            double tMax = std::numeric_limits<double>::infinity())
         :
             O(from),
-            D(dir)
+            D(dir),
+            tMin(tMin),
+            tMax(tMax)
         {}
 
+        bool inRange(double t) const
+        {
+            return tMin <= t and t <= tMax;
+        }
+
         Point at(double t) const
         {
             return O + t * D;
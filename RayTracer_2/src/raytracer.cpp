@@ -1,8 +1,13 @@
 #include "raytracer.h"
 
+#include "framebuffer.h"
 #include "image.h"
+#include "imagestream.h"
 #include "light.h"
 #include "material.h"
+#include "outputsink.h"
+#include "sampler.h"
+#include "tiles.h"
 #include "triple.h"
 
 // =============================================================================
@@ -18,16 +23,45 @@
 
 #include "json/json.h"
 
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
 
 using namespace std;        // no std:: required
 using json = nlohmann::json;
 
+namespace
+{
+    // Set by SIGINT and SIGTERM during a render
+    atomic<bool> stopRequested(false);
+
+    void requestStop(int)
+    {
+        stopRequested = true;
+    }
+
+    // 64 bit FNV-1a hash
+    uint64_t fnv1a(string const &text)
+    {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (unsigned char ch : text)
+        {
+            hash ^= ch;
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+}
+
 bool Raytracer::parseObjectNode(json const &node)
 {
-    ObjectPtr obj = nullptr;
+    Object *obj = nullptr;      // owned by the scene
 
 // =============================================================================
 // -- Determine type and parse object parametrers ------------------------------
@@ -42,11 +76,11 @@ bool Raytracer::parseObjectNode(json const &node)
             // Create sphere with rotation
             Vector rotation(node["rotation"]);
             double angle = node["angle"];
-            obj = ObjectPtr(new Sphere(pos, radius, rotation, angle));
+            obj = scene.addObject<Sphere>(pos, radius, rotation, angle);
         }
         else
         {
-            obj = ObjectPtr(new Sphere(pos, radius));
+            obj = scene.addObject<Sphere>(pos, radius);
         }
     }
     else if (node["type"] == "quad")
@@ -55,7 +89,7 @@ bool Raytracer::parseObjectNode(json const &node)
         Point v1(node["v1"]);
         Point v2(node["v2"]);
         Point v3(node["v3"]);
-        obj = ObjectPtr(new Quad(v0, v1, v2, v3));
+        obj = scene.addObject<Quad>(v0, v1, v2, v3);
     }
     else
     {
@@ -69,9 +103,8 @@ bool Raytracer::parseObjectNode(json const &node)
     if (!obj)
         return false;
 
-    // Parse material and add object to the scene
+    // Parse material of the object (already added to the scene)
     obj->material = parseMaterialNode(node["material"]);
-    scene.addObject(obj);
     return true;
 }
 
@@ -119,8 +152,9 @@ try
     // Read and parse input json file
     ifstream infile(ifname);
     if (!infile) throw runtime_error("Could not open input file for reading.");
-    json jsonscene;
-    infile >> jsonscene;
+    string text((istreambuf_iterator<char>(infile)),
+                istreambuf_iterator<char>());
+    json jsonscene = json::parse(text);
 
 // =============================================================================
 // -- Read your scene data in this section -------------------------------------
@@ -129,6 +163,56 @@ try
     Point eye(jsonscene["Eye"]);
     scene.setEye(eye);
 
+    if (jsonscene.count("Width"))
+    {
+        unsigned size = jsonscene["Width"];
+        width = size;
+    }
+
+    if (jsonscene.count("Height"))
+    {
+        unsigned size = jsonscene["Height"];
+        height = size;
+    }
+
+    if (width == 0 or height == 0)
+        throw runtime_error("Width and Height must be positive.");
+
+    if (jsonscene.count("FramebufferFormat"))
+    {
+        string name = jsonscene["FramebufferFormat"];
+        if (!pixelFormatFromName(name, framebufferFormat))
+            throw runtime_error("Unknown framebuffer format: " + name + ".");
+
+        // The denoiser reads the colors back, which 8 bits are too coarse
+        // for.
+        if (framebufferFormat == PixelFormat::BYTE
+            and jsonscene.count("Denoise") and jsonscene["Denoise"] == true)
+            throw runtime_error("An 8bit framebuffer cannot be denoised.");
+    }
+
+    if (jsonscene.count("FramebufferMemory"))
+    {
+        double megabytes = jsonscene["FramebufferMemory"];
+        framebufferMemory = megabytes;
+    }
+
+    if (jsonscene.count("PngCompression"))
+    {
+        unsigned level = jsonscene["PngCompression"];
+        if (level > 9)
+            throw runtime_error("PngCompression must be 0 to 9.");
+        pngCompression = level;
+    }
+
+    if (jsonscene.count("PreviewCompression"))
+    {
+        unsigned level = jsonscene["PreviewCompression"];
+        if (level > 9)
+            throw runtime_error("PreviewCompression must be 0 to 9.");
+        previewCompression = level;
+    }
+
     if (jsonscene.count("MaxRecursionDepth"))
     {
         int depth = jsonscene["MaxRecursionDepth"];
@@ -147,6 +231,125 @@ try
         scene.setSuperSample(factor);
     }
 
+    if (jsonscene.count("Sampler"))
+    {
+        string name = jsonscene["Sampler"];
+        unique_ptr<Sampler> sampler = makeSampler(name);
+        if (!sampler)
+            throw runtime_error("Unknown sampler: " + name + ".");
+        scene.setSampler(move(sampler));
+    }
+
+    if (jsonscene.count("Threads"))
+    {
+        unsigned threads = jsonscene["Threads"];
+        scene.setThreads(threads);
+        numThreads = threads;
+    }
+
+    if (jsonscene.count("TileSize"))
+    {
+        unsigned size = jsonscene["TileSize"];
+        scene.setTileSize(size);
+    }
+
+    if (jsonscene.count("PacketSize"))
+    {
+        unsigned size = jsonscene["PacketSize"];
+        scene.setPacketSize(size);
+    }
+
+    if (jsonscene.count("Wavefront"))
+    {
+        bool enabled = jsonscene["Wavefront"];
+        scene.setWavefront(enabled);
+    }
+
+    if (jsonscene.count("MinContribution"))
+    {
+        double threshold = jsonscene["MinContribution"];
+        scene.setMinContribution(threshold);
+    }
+
+    if (jsonscene.count("RussianRoulette"))
+    {
+        bool enabled = jsonscene["RussianRoulette"];
+        scene.setRussianRoulette(enabled);
+    }
+
+    if (jsonscene.count("LightThreshold"))
+    {
+        double threshold = jsonscene["LightThreshold"];
+        scene.setLightThreshold(threshold);
+    }
+
+    if (jsonscene.count("LightSamples"))
+    {
+        unsigned count = jsonscene["LightSamples"];
+        scene.setLightSamples(count);
+    }
+
+    if (jsonscene.count("AdaptiveSampling"))
+    {
+        bool enabled = jsonscene["AdaptiveSampling"];
+        scene.setAdaptive(enabled);
+    }
+
+    if (jsonscene.count("AdaptiveThreshold"))
+    {
+        double threshold = jsonscene["AdaptiveThreshold"];
+        scene.setAdaptiveThreshold(threshold);
+    }
+
+    if (jsonscene.count("Progressive"))
+    {
+        bool enabled = jsonscene["Progressive"];
+        scene.setProgressive(enabled);
+    }
+
+    if (jsonscene.count("PreviewInterval"))
+    {
+        double seconds = jsonscene["PreviewInterval"];
+        scene.setPreviewInterval(seconds);
+    }
+
+    if (jsonscene.count("Denoise"))
+    {
+        bool enabled = jsonscene["Denoise"];
+        scene.setDenoise(enabled);
+    }
+
+    if (jsonscene.count("TimeBudget"))
+    {
+        double seconds = jsonscene["TimeBudget"];
+        scene.setTimeBudget(seconds);
+    }
+
+    if (jsonscene.count("Checkpoint"))
+    {
+        // A checkpoint only fits the scene file it was made for.
+        string filename = jsonscene["Checkpoint"];
+        scene.setCheckpoint(filename, fnv1a(text));
+    }
+
+    if (jsonscene.count("CheckpointInterval"))
+    {
+        double seconds = jsonscene["CheckpointInterval"];
+        scene.setCheckpointInterval(seconds);
+    }
+
+    if (jsonscene.count("Crop"))
+    {
+        // [x, y, width, height] in pixels, y counting down from the top
+        vector<unsigned> crop = jsonscene["Crop"];
+        if (crop.size() != 4 or crop[2] == 0 or crop[3] == 0)
+            throw runtime_error("Crop must be [x, y, width, height].");
+        scene.setCrop(crop[0], crop[1], crop[2], crop[3]);
+    }
+
+    if (jsonscene.count("CropPatch"))
+        patchCrop = jsonscene["CropPatch"];
+
     if (jsonscene.count("Shadows"))
     {
         bool shadows = jsonscene["Shadows"];
@@ -163,6 +366,8 @@ try
 
     cout << "Parsed " << objCount << " objects.\n";
 
+    scene.buildBVH();
+
 // =============================================================================
 // -- End of scene data reading ------------------------------------------------
 // =============================================================================
@@ -175,13 +380,122 @@ catch (exception const &ex)
     return false;
 }
 
-void Raytracer::renderToFile(string const &ofname)
+void Raytracer::setSize(unsigned imageWidth, unsigned imageHeight)
 {
-    // TODO: the size may be a settings in your file
-    Image img(400, 400);
+    width = imageWidth;
+    height = imageHeight;
+}
+
+bool Raytracer::renderToFile(string const &ofname)
+try
+{
+    // A framebuffer too large for memory is mapped from a file, which is
+    // paged out tile by tile as the render goes.
+    unique_ptr<Framebuffer> framebuffer;
+    double megabytes = static_cast<double>(width) * height
+                       * pixelBytes(framebufferFormat) / (1 << 20);
+    if (megabytes > framebufferMemory)
+    {
+        cout << "Keeping the " << megabytes << " MB framebuffer in "
+             << ofname << ".framebuffer.\n";
+        framebuffer.reset(new Framebuffer(width, height, framebufferFormat,
+                                          ofname + ".framebuffer"));
+    }
+    else
+        framebuffer.reset(new Framebuffer(width, height, framebufferFormat));
+    Framebuffer &img = *framebuffer;
+
+    Tile window = scene.cropWindow(img.width(), img.height());
+    unsigned cropWidth = window.x1 - window.x0;
+    unsigned cropHeight = window.y1 - window.y0;
+    bool cropped = cropWidth != img.width() or cropHeight != img.height();
+
+    // A patched crop starts from the image in the output file, provided it
+    // has the right size: the pixels outside the window are kept.
+    if (cropped and patchCrop)
+    {
+        Image previous;
+        previous.read_png(ofname);
+        if (previous.width() == img.width()
+            and previous.height() == img.height())
+        {
+            for (unsigned y = 0; y != img.height(); ++y)
+                for (unsigned x = 0; x != img.width(); ++x)
+                    img.put_pixel(x, y, previous(x, y));
+        }
+        else
+            cout << "No " << img.width() << 'x' << img.height()
+                 << " image in " << ofname << " to patch, starting black.\n";
+    }
+
+    // Otherwise only the window is written. Rows are written as soon as
+    // they are rendered, into a sink chosen by the name of the file.
+    Tile output = cropped and not patchCrop
+                  ? window : Tile{0, 0, img.width(), img.height()};
+    unique_ptr<OutputSink> sink = makeSink(ofname, pngCompression,
+                                           numThreads);
+    ImageStream stream(img, *sink, output, window);
+
     cout << "Tracing...\n";
-    scene.render(img);
+    auto start = chrono::steady_clock::now();
+
+    // SIGINT and SIGTERM stop the render, which then saves its checkpoint;
+    // the image so far is still written.
+    stopRequested = false;
+    scene.setStopFlag(&stopRequested);
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+
+    // Progressive renders write the image so far now and then, except to
+    // stdout.
+    auto snapshot = [&](Framebuffer const &preview)
+    {
+        if (ofname == "-")
+            return;
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        cout << "Writing preview after " << elapsed.count() << " s.\n";
+        writeImage(preview,
+                   *makeSink(ofname, previewCompression, numThreads), output);
+    };
+    bool finished = scene.render(img, snapshot, [&](Tile const &tile)
+    {
+        stream.tileDone(tile);
+    });
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    scene.setStopFlag(nullptr);
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    if (finished)
+        cout << "Traced in " << elapsed.count() << " s.\n";
+    else
+        cout << "Stopped after " << elapsed.count() << " s.\n";
+
+    RenderStats const &stats = scene.getStats();
+    double numPixels = static_cast<double>(cropWidth) * cropHeight;
+    cout << "Primary rays: " << stats.primaryRays << " ("
+         << static_cast<double>(stats.primaryRays) / numPixels
+         << " per pixel)";
+    if (stats.refinedPixels > 0)
+        cout << ", " << 100.0 * stats.refinedPixels / numPixels
+             << "% of the pixels refined";
+    cout << ".\n";
+    if (stats.shadowRays > 0)
+        cout << "Shadow rays: " << stats.shadowRays << ", "
+             << 100.0 * stats.occluderHits / stats.shadowRays
+             << "% blocked by the cached occluder.\n";
     cout << "Writing image to " << ofname << "...\n";
-    img.write_png(ofname);
+    if (not stream.finish())
+    {
+        cerr << "Error: writing " << ofname << " failed.\n";
+        return false;
+    }
     cout << "Done.\n";
+    return finished;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
 }
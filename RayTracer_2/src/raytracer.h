@@ -1,6 +1,7 @@
 #ifndef RAYTRACER_H_
 #define RAYTRACER_H_
 
+#include "framebuffer.h"
 #include "scene.h"
 
 #include <string>
@@ -15,10 +16,33 @@ class Raytracer
 {
     Scene scene;
 
+    // Size of the image, how its framebuffer stores the pixels, and the
+    // most memory (in MB) it may take: larger ones are kept in a file next
+    // to the output.
+    unsigned width = 400;
+    unsigned height = 400;
+    PixelFormat framebufferFormat = PixelFormat::DOUBLE;
+    double framebufferMemory = 1024;
+
+    // Compression level (0: none, 9: best) of the PNG, and of the
+    // previews written while rendering progressively, which need to be
+    // quick rather than small; and the threads compressing it.
+    int pngCompression = 6;
+    int previewCompression = 1;
+    unsigned numThreads = 0;
+
+    // With a crop window in the scene, renderToFile() renders it into the
+    // image already in the output file (patchCrop), or writes it as an
+    // image of its own.
+    bool patchCrop = false;
+
     public:
 
         bool readScene(std::string const &ifname);
-        void renderToFile(std::string const &ofname);
+        // overrides the size of the scene file
+        void setSize(unsigned width, unsigned height);
+        // returns false if the render was stopped by a signal
+        bool renderToFile(std::string const &ofname);
 
     private:
 
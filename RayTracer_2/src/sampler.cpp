@@ -0,0 +1,245 @@
+#include "sampler.h"
+
+#include <cmath>
+#include <cstdint>
+
+using namespace std;
+
+namespace
+{
+    // Integer hash (by Chris Wellons), for seeds and random numbers that
+    // only depend on their arguments.
+    uint32_t mix(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    uint32_t mix(uint32_t a, uint32_t b, uint32_t c)
+    {
+        return mix(a ^ mix(b ^ mix(c)));
+    }
+
+    double toUnit(uint32_t bits)
+    {
+        return bits * (1.0 / 4294967296.0);
+    }
+
+    // Side of the grid of count samples
+    unsigned gridSize(unsigned count)
+    {
+        return static_cast<unsigned>(sqrt(count) + 0.5);
+    }
+
+    uint32_t reverseBits(uint32_t x)
+    {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+        x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+        return x;
+    }
+
+    // The first two dimensions of the Sobol sequence, as 32 bit fractions
+    uint32_t sobol0(uint32_t index)
+    {
+        return reverseBits(index);
+    }
+
+    uint32_t sobol1(uint32_t index)
+    {
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+            if (index & 1)
+                result ^= v;
+        return result;
+    }
+
+    // Owen scrambling: a random permutation of every half, quarter, eighth,
+    // ... of [0, 1), which keeps the sequence evenly spread. Hash-based, as
+    // in Burley, "Practical Hash-based Owen Scrambling" (2020).
+    uint32_t owenScramble(uint32_t x, uint32_t seed)
+    {
+        x = reverseBits(x);
+        x ^= x * 0x3d20adeau;
+        x += seed;
+        x *= (seed >> 16) | 1;
+        x ^= x * 0x05526c56u;
+        x ^= x * 0x53a22864u;
+        return reverseBits(x);
+    }
+
+    // Ranks the cells of a toroidal size x size tile with the
+    // void-and-cluster method (Ulichney, 1993): every next cell is the one
+    // farthest from those ranked before it. Returns the ranks scaled to
+    // [0, 1), cell (x, y) at index y * size + x.
+    vector<double> voidAndCluster(unsigned size)
+    {
+        unsigned const numCells = size * size;
+        double const sigma = 1.5;
+
+        // How much a cell adds to the energy of the cell at offset (dx, dy)
+        vector<double> kernel(numCells);
+        for (unsigned dy = 0; dy != size; ++dy)
+            for (unsigned dx = 0; dx != size; ++dx)
+            {
+                double distX = min(dx, size - dx);
+                double distY = min(dy, size - dy);
+                kernel[dy * size + dx] = exp(-(distX * distX + distY * distY)
+                                             / (2 * sigma * sigma));
+            }
+
+        vector<bool> filled(numCells, false);
+        vector<double> energy(numCells, 0.0);
+        auto toggle = [&](unsigned cell)
+        {
+            filled[cell] = not filled[cell];
+            double sign = filled[cell] ? 1.0 : -1.0;
+            unsigned cellX = cell % size;
+            unsigned cellY = cell / size;
+            for (unsigned dy = 0; dy != size; ++dy)
+            {
+                unsigned row = (cellY + dy) % size * size;
+                for (unsigned dx = 0; dx != size; ++dx)
+                    energy[row + (cellX + dx) % size]
+                        += sign * kernel[dy * size + dx];
+            }
+        };
+
+        // The filled cell with the most filled cells around it, and the
+        // empty cell with the fewest
+        auto tightestCluster = [&]()
+        {
+            unsigned best = numCells;
+            for (unsigned cell = 0; cell != numCells; ++cell)
+                if (filled[cell] and
+                    (best == numCells or energy[cell] > energy[best]))
+                    best = cell;
+            return best;
+        };
+        auto largestVoid = [&]()
+        {
+            unsigned best = numCells;
+            for (unsigned cell = 0; cell != numCells; ++cell)
+                if (not filled[cell] and
+                    (best == numCells or energy[cell] < energy[best]))
+                    best = cell;
+            return best;
+        };
+
+        // Initial pattern: a tenth of the cells at random, spread out by
+        // moving the tightest cluster into the largest void until that
+        // changes nothing.
+        unsigned numInitial = numCells / 10;
+        for (uint32_t seed = 0, count = 0; count != numInitial; ++seed)
+        {
+            unsigned cell = mix(seed) % numCells;
+            if (not filled[cell])
+            {
+                toggle(cell);
+                ++count;
+            }
+        }
+        for (unsigned pass = 0; pass != numCells; ++pass)
+        {
+            unsigned cluster = tightestCluster();
+            toggle(cluster);
+            unsigned largest = largestVoid();
+            toggle(largest);
+            if (largest == cluster)
+                break;
+        }
+
+        vector<unsigned> rank(numCells);
+        vector<bool> initialFilled = filled;
+        vector<double> initialEnergy = energy;
+
+        // The initial cells are ranked by removing them, tightest first,
+        for (unsigned count = numInitial; count != 0; --count)
+        {
+            unsigned cluster = tightestCluster();
+            toggle(cluster);
+            rank[cluster] = count - 1;
+        }
+
+        // the others by filling the largest void, one by one.
+        filled = initialFilled;
+        energy = initialEnergy;
+        for (unsigned count = numInitial; count != numCells; ++count)
+        {
+            unsigned largest = largestVoid();
+            toggle(largest);
+            rank[largest] = count;
+        }
+
+        vector<double> tile(numCells);
+        for (unsigned cell = 0; cell != numCells; ++cell)
+            tile[cell] = (rank[cell] + 0.5) / numCells;
+        return tile;
+    }
+}
+
+void GridSampler::sample(unsigned x, unsigned y, unsigned index,
+                         unsigned count, double &u, double &v) const
+{
+    unsigned size = gridSize(count);
+    double sub = (double) 1 / (2*size);
+    u = sub + (double) (index / size)/size;
+    v = sub + (double) (index % size)/size;
+}
+
+void JitteredSampler::sample(unsigned x, unsigned y, unsigned index,
+                             unsigned count, double &u, double &v) const
+{
+    unsigned size = gridSize(count);
+    u = (index / size + toUnit(mix(x, y, 2 * index))) / size;
+    v = (index % size + toUnit(mix(x, y, 2 * index + 1))) / size;
+}
+
+void SobolSampler::sample(unsigned x, unsigned y, unsigned index,
+                          unsigned count, double &u, double &v) const
+{
+    u = toUnit(owenScramble(sobol0(index), mix(x, y, 0)));
+    v = toUnit(owenScramble(sobol1(index), mix(x, y, 1)));
+}
+
+BlueNoiseSampler::BlueNoiseSampler()
+:
+    d_tile(voidAndCluster(TILE_SIZE))
+{}
+
+void BlueNoiseSampler::sample(unsigned x, unsigned y, unsigned index,
+                              unsigned count, double &u, double &v) const
+{
+    // The second shift comes from the opposite corner of the tile, so the
+    // two are unrelated.
+    unsigned const half = TILE_SIZE / 2;
+    double shiftU = d_tile[y % TILE_SIZE * TILE_SIZE + x % TILE_SIZE];
+    double shiftV = d_tile[(y + half) % TILE_SIZE * TILE_SIZE
+                           + (x + half) % TILE_SIZE];
+
+    u = toUnit(sobol0(index)) + shiftU;
+    v = toUnit(sobol1(index)) + shiftV;
+    if (u >= 1.0)
+        u -= 1.0;
+    if (v >= 1.0)
+        v -= 1.0;
+}
+
+unique_ptr<Sampler> makeSampler(string const &name)
+{
+    if (name == "grid")
+        return unique_ptr<Sampler>(new GridSampler());
+    if (name == "jittered")
+        return unique_ptr<Sampler>(new JitteredSampler());
+    if (name == "sobol")
+        return unique_ptr<Sampler>(new SobolSampler());
+    if (name == "bluenoise")
+        return unique_ptr<Sampler>(new BlueNoiseSampler());
+    return nullptr;
+}
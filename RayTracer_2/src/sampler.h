@@ -0,0 +1,70 @@
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Positions of the samples within a pixel. Sample index (0 <= index <
+// count) of pixel (x, y) lies at offset (u, v) in [0, 1) x [0, 1) from the
+// pixel's top left corner. The offsets depend on nothing but the arguments,
+// so a render gives the same image whatever the order of its pixels and
+// threads.
+class Sampler
+{
+    public:
+        virtual ~Sampler() = default;
+
+        virtual void sample(unsigned x, unsigned y, unsigned index,
+                            unsigned count, double &u, double &v) const = 0;
+};
+
+// The centres of a regular n x n grid (count = n * n), index i * n + j
+// being column i and row j.
+class GridSampler: public Sampler
+{
+    public:
+        void sample(unsigned x, unsigned y, unsigned index, unsigned count,
+                    double &u, double &v) const override;
+};
+
+// The cells of the grid, each at a random position within its cell.
+class JitteredSampler: public Sampler
+{
+    public:
+        void sample(unsigned x, unsigned y, unsigned index, unsigned count,
+                    double &u, double &v) const override;
+};
+
+// The Sobol sequence, Owen-scrambled with a different seed per pixel. Any
+// power of 2 of samples is evenly spread.
+class SobolSampler: public Sampler
+{
+    public:
+        void sample(unsigned x, unsigned y, unsigned index, unsigned count,
+                    double &u, double &v) const override;
+};
+
+// The same Sobol points in every pixel, shifted (modulo 1) by values from
+// a tile of blue noise. Neighbouring pixels thus get very different shifts
+// and the remaining error looks like fine, even grain instead of blotches.
+class BlueNoiseSampler: public Sampler
+{
+    public:
+        static unsigned const TILE_SIZE = 64;
+
+        BlueNoiseSampler();
+
+        void sample(unsigned x, unsigned y, unsigned index, unsigned count,
+                    double &u, double &v) const override;
+
+    private:
+        std::vector<double> d_tile;   // TILE_SIZE x TILE_SIZE, in [0, 1)
+};
+
+// The sampler called name ("grid", "jittered", "sobol" or "bluenoise"), or
+// nullptr if there is no such sampler.
+std::unique_ptr<Sampler> makeSampler(std::string const &name);
+
+#endif
@@ -1,107 +1,491 @@
 #include "scene.h"
 
+#include "checkpoint.h"
+#include "denoiser.h"
+#include "framebuffer.h"
 #include "hit.h"
-#include "image.h"
 #include "material.h"
 #include "ray.h"
+#include "shapes/quad.h"
+#include "shapes/sphere.h"
+#include "threadpool.h"
+#include "tiles.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
 #include <limits>
 
 using namespace std;
 
-pair<ObjectPtr, Hit> Scene::castRay(Ray const &ray) const
+namespace
 {
-    // Find hit object and distance
-    Hit min_hit(numeric_limits<double>::infinity(), Vector());
-    ObjectPtr obj = nullptr;
-    for (unsigned idx = 0; idx != objects.size(); ++idx)
+    // Position of value in [0, 1) on a scale of levels steps, clamped.
+    unsigned quantize(double value, unsigned levels)
+    {
+        if (not (value > 0.0))      // also NaN
+            return 0;
+        if (value >= 1.0)
+            return levels - 1;
+        return static_cast<unsigned>(value * levels);
+    }
+
+    // Sort key of a ray: the cell of its origin within bounds (1024 cells
+    // per axis, along a Morton curve), then its direction (8 steps per
+    // component). Rays with close keys start close together and head the
+    // same way, so they tend to visit the same nodes and objects.
+    unsigned long long rayKey(Ray const &ray, AABB const &bounds)
     {
-        Hit hit(objects[idx]->intersect(ray));
-        if (hit.t < min_hit.t)
+        unsigned cell[3];
+        unsigned dir[3];
+        for (unsigned axis = 0; axis != 3; ++axis)
         {
-            min_hit = hit;
-            obj = objects[idx];
+            double extent = bounds.max.data[axis] - bounds.min.data[axis];
+            double offset = ray.O.data[axis] - bounds.min.data[axis];
+            cell[axis] = quantize(extent > 0.0 ? offset / extent : 0.0, 1024);
+            dir[axis] = quantize((ray.D.data[axis] + 1.0) / 2.0, 8);
         }
+
+        unsigned long long key = 0;
+        for (unsigned bit = 10; bit-- > 0; )
+            for (unsigned axis = 0; axis != 3; ++axis)
+                key = (key << 1) | ((cell[axis] >> bit) & 1);
+        for (unsigned axis = 0; axis != 3; ++axis)
+            key = (key << 3) | dir[axis];
+        return key;
+    }
+
+    // Indices first, ..., last - 1 into rays, sorted by rayKey.
+    template <typename Rays, typename GetRay>
+    vector<unsigned> sortRays(Rays const &rays, unsigned first, unsigned last,
+                              AABB const &bounds, GetRay getRay)
+    {
+        vector<pair<unsigned long long, unsigned>> keys;
+        keys.reserve(last - first);
+        for (unsigned idx = first; idx != last; ++idx)
+            keys.push_back(make_pair(rayKey(getRay(rays[idx]), bounds), idx));
+        sort(keys.begin(), keys.end());
+
+        vector<unsigned> order;
+        order.reserve(keys.size());
+        for (auto const &key : keys)
+            order.push_back(key.second);
+        return order;
     }
 
-    return pair<ObjectPtr, Hit>(obj, min_hit);
+    // A ray of renderWavefront, with what is needed to combine its color
+    // with that of the rays it spawned.
+    struct WaveRay
+    {
+        Ray ray;
+        unsigned depth;             // bounces left
+        double throughput;          // weight of its color in the pixel
+        Color color;                // own shading, later plus the children
+        unsigned numChildren;
+        unsigned children[2];       // reflection and refraction rays
+        double weights[2];
+
+        WaveRay(Ray const &ray, unsigned depth, double throughput)
+        :
+            ray(ray),
+            depth(depth),
+            throughput(throughput),
+            color(0.0, 0.0, 0.0),
+            numChildren(0)
+        {}
+    };
+
+    // Uniform number in [0, 1) derived from the bits of the values and the
+    // seed: the same input always gives the same number.
+    double hashRandom(initializer_list<double> values,
+                      unsigned long long seed = 0)
+    {
+        unsigned long long state = seed;
+        for (double value : values)
+        {
+            unsigned long long bits;
+            memcpy(&bits, &value, sizeof bits);
+
+            // splitmix64
+            state += bits + 0x9E3779B97F4A7C15ULL;
+            state = (state ^ (state >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            state = (state ^ (state >> 27)) * 0x94D049BB133111EBULL;
+            state ^= state >> 31;
+        }
+        return (state >> 11) * (1.0 / (1ULL << 53));
+    }
+
+    double rayRandom(Ray const &ray)
+    {
+        return hashRandom({ray.O.x, ray.O.y, ray.O.z,
+                           ray.D.x, ray.D.y, ray.D.z});
+    }
+
+    // Upper bound of L.dot(A) for the directions L from p to the points of
+    // the box; 0 only if that is never positive.
+    double maxCosine(AABB const &box, Point const &p, Vector const &A)
+    {
+        // The dot product is largest in one of the corners, and so is the
+        // distance to p.
+        double maxDot = 0.0;
+        double maxDist2 = 0.0;
+        double minDist2 = 0.0;
+        for (unsigned axis = 0; axis != 3; ++axis)
+        {
+            double toMin = box.min.data[axis] - p.data[axis];
+            double toMax = box.max.data[axis] - p.data[axis];
+            maxDot += (A.data[axis] >= 0.0 ? toMax : toMin) * A.data[axis];
+            maxDist2 += max(toMin * toMin, toMax * toMax);
+            if (toMin > 0.0)
+                minDist2 += toMin * toMin;
+            else if (toMax < 0.0)
+                minDist2 += toMax * toMax;
+        }
+
+        // Everything lies behind the plane through p perpendicular to A.
+        // The margin covers rounding in the shading itself, for a light
+        // exactly in the plane.
+        double length = A.length();
+        if (maxDot < -1E-9 * sqrt(maxDist2) * length)
+            return 0.0;
+
+        if (maxDot <= 0.0 or minDist2 == 0.0)
+            return length;
+        return min(length, maxDot / sqrt(minDist2));
+    }
+
+    // Number of initial samples per axis of adaptive supersampling, and
+    // the cosine of the largest angle between normals that is no edge.
+    unsigned const ADAPTIVE_BASE = 2;
+    double const ADAPTIVE_NORMAL_COS = 0.95;
+    double const ADAPTIVE_CONTRAST = 2.0;   // times the threshold
+
+    // The initial samples of a pixel in adaptive supersampling.
+    struct PixelSamples
+    {
+        Color colors[ADAPTIVE_BASE * ADAPTIVE_BASE];
+        Color mean;
+        Object const *obj;          // hit by all samples, or nullptr
+        bool uniform;               // all samples hit obj (or nothing)
+        Vector N;                   // sum of the normals
+    };
+
+    // Subpixel index of initial sample k (per axis) out of a grid of
+    // factor x factor: the centres of ADAPTIVE_BASE equal parts.
+    unsigned baseIndex(unsigned k, unsigned factor)
+    {
+        return (2 * k + 1) * factor / (2 * ADAPTIVE_BASE);
+    }
+
+    // A shadow ray of a light sample (see Scene::selectLights).
+    struct ShadowRay
+    {
+        Ray ray;
+        unsigned sample;            // index into the samples of the bounce
+    };
 }
 
-Color Scene::trace(Ray const &ray, unsigned depth)
+void Scene::buildBVH()
 {
-    pair<ObjectPtr, Hit> mainhit = castRay(ray);
-    ObjectPtr obj = mainhit.first;
-    Hit min_hit = mainhit.second;
+    vector<Sphere const *> sphereObjects;
+    vector<Quad const *> quadObjects;
+    vector<Object const *> otherObjects;
+
+    bounds = AABB();
+    bounds.extend(eye);
+    for (Object const *obj : objects)
+    {
+        bounds.extend(obj->boundingBox());
+        if (auto sphere = dynamic_cast<Sphere const *>(obj))
+            sphereObjects.push_back(sphere);
+        else if (auto quad = dynamic_cast<Quad const *>(obj))
+            quadObjects.push_back(quad);
+        else
+            otherObjects.push_back(obj);
+    }
+
+    spheres.build(sphereObjects);
+    quads.build(quadObjects);
+    others.build(otherObjects);
+    lightTree.build(lights);
+}
 
+pair<Object const *, Hit> Scene::castRay(Ray const &ray) const
+{
+    // Find hit object and distance
+    HitRecord closest;
+
+    // The interval of the ray shrinks to the closest hit found so far, so
+    // farther objects (and bounding boxes) are rejected early, also in the
+    // groups searched later.
+    Ray segment(ray);
+    spheres.intersect(segment, closest);
+    quads.intersect(segment, closest);
+    others.intersect(segment, closest);
+
+    return pair<Object const *, Hit>(closest.obj, closest.hit);
+}
+
+void Scene::castPacket(RayPacket &packet, HitRecord *closest) const
+{
+    // Every lane shrinks its own interval, as in castRay.
+    spheres.intersect(packet, closest);
+    quads.intersect(packet, closest);
+    others.intersect(packet, closest);
+}
+
+bool Scene::occluded(Ray const &ray) const
+{
+    return occluder(ray) != nullptr;
+}
+
+Object const *Scene::occluder(Ray const &ray) const
+{
+    // Any hit will do: stop at the first one.
+    Object const *blocker = spheres.occluder(ray);
+    if (not blocker)
+        blocker = quads.occluder(ray);
+    if (not blocker)
+        blocker = others.occluder(ray);
+    return blocker;
+}
+
+bool Scene::occluded(Ray const &ray, unsigned light,
+                     TraceContext &context) const
+{
+    ++context.stats.shadowRays;
+
+    // A single test often settles it. It agrees with the full search, so
+    // the cache never changes the image.
+    Object const *&last = context.occluders[light];
+    if (last and last->occluded(ray))
+    {
+        ++context.stats.occluderHits;
+        return true;
+    }
+
+    Object const *blocker = occluder(ray);
+    if (blocker)
+        last = blocker;
+    return blocker != nullptr;
+}
+
+Color Scene::trace(Ray const &ray, unsigned depth, TraceContext &context,
+                   double throughput) const
+{
+    pair<Object const *, Hit> mainhit = castRay(ray);
+    return shade(ray, mainhit.first, mainhit.second, depth, context,
+                 throughput);
+}
+
+Color Scene::shade(Ray const &ray, Object const *obj, Hit min_hit,
+                   unsigned depth, TraceContext &context,
+                   double throughput) const
+{
     // No hit? Return background color.
     if (!obj)
         return Color(0.0, 0.0, 0.0);
 
-    Material const &material = obj->material;
-    Point hit = ray.at(min_hit.t);
-    Vector V = -ray.D;
+    SurfacePoint point = surfacePoint(ray, obj, min_hit);
+
+    // Add ambient once, regardless of the number of lights.
+    Color color = point.material->ka * point.matColor;
+
+    // Add diffuse and specular components.
+    vector<LightSample> samples;
+    selectLights(point, samples);
+    for (LightSample const &sample : samples)
+    {
+        Light const &light = lights[sample.light];
+
+        // No intersection was found for shadow ray before the light
+        // => the object does not have a shadow
+        if (!renderShadows ||
+            !occluded(shadowRay(point, light), sample.light, context))
+            illuminate(point, light, sample.weight, color);
+    }
+
+    if (depth > 0)
+        spawnRays(ray, point, throughput,
+                  [&](Ray const &next, double weight, double nextThroughput)
+        {
+            // Recursively trace a new ray in this direction with decresed depth
+            color += weight * trace(next, depth - 1, context, nextThroughput);
+        });
+
+    return color;
+}
+
+Scene::SurfacePoint Scene::surfacePoint(Ray const &ray, Object const *obj,
+                                        Hit min_hit) const
+{
+    // Only now compute the normal (and texture coordinates) of the hit.
+    obj->finalize(ray, min_hit);
+
+    SurfacePoint point;
+    point.material = &obj->material;
+    point.hit = ray.at(min_hit.t);
+    point.V = -ray.D;
 
     // Pre-condition: For closed objects, N points outwards.
-    Vector N = min_hit.N;
+    point.N = min_hit.N;
 
     // The shading normal always points in the direction of the view,
     // as required by the Phong illumination model.
-    Vector shadingN;
-    if (N.dot(V) >= 0.0)
-        shadingN = N;
+    if (point.N.dot(point.V) >= 0.0)
+        point.shadingN = point.N;
     else
-        shadingN = -N;
-
-    // Account for shadow acne
-    Point hit_acne = hit + epsilon * shadingN;
-
-    Color matColor;
+        point.shadingN = -point.N;
 
+    Material const &material = *point.material;
     if (material.hasTexture) {
-        Vector mappedText = obj->toUV(hit);
-        matColor = material.texture.colorAt(mappedText.x, 1.0 - mappedText.y);
+        Vector mappedText = min_hit.uv;
+        point.matColor = material.texture.colorAt(mappedText.x, 1.0 - mappedText.y);
     } else {
-        matColor = material.color;
+        point.matColor = material.color;
     }
+    return point;
+}
 
-    // Add ambient once, regardless of the number of lights.
-    Color color = material.ka * matColor;
+Ray Scene::shadowRay(SurfacePoint const &point, Light const &light) const
+{
+    Vector L = (light.position - point.hit).normalized();
 
-    // Add diffuse and specular components.
-    for (auto const &light : lights)
+    // Cast shadow ray, only objects between the hit and the light matter
+    double distSL = (light.position - point.hit).length();
+    return Ray(point.hit, L, epsilon, distSL);
+}
+
+void Scene::illuminate(SurfacePoint const &point, Light const &light,
+                       double weight, Color &color) const
+{
+    Material const &material = *point.material;
+    Vector L = (light.position - point.hit).normalized();
+
+    // Diffuse.
+    double diffuse = std::max(point.shadingN.dot(L), 0.0);
+    Color diffuseColor = diffuse * material.kd * light.color * point.matColor;
+
+    // Specular.
+    Vector reflectDir = reflect(-L, point.shadingN);
+    double specAngle = std::max(reflectDir.dot(point.V), 0.0);
+    double specular = std::pow(specAngle, material.n);
+    Color specularColor = specular * material.ks * light.color;
+
+    if (weight != 1.0)
     {
-        Vector L = (light->position - hit).normalized();
+        diffuseColor *= weight;
+        specularColor *= weight;
+    }
+    color += diffuseColor;
+    color += specularColor;
+}
 
-        // Cast shadow ray
-        Ray shadow(hit_acne, L);
-        pair<ObjectPtr, Hit> shadowHit = castRay(shadow);
-        ObjectPtr obj_shadow = shadowHit.first;
-        Hit hit_shadow = shadowHit.second;
+double Scene::lightImportance(SurfacePoint const &point, Vector const &R,
+                              AABB const &box, Color const &power) const
+{
+    // The diffuse term is max(shadingN.dot(L), 0), the specular one
+    // max(R.dot(L), 0)^n with R the mirrored view direction: both vanish
+    // for lights behind the respective planes.
+    Material const &material = *point.material;
+    double cosN = maxCosine(box, point.hit, point.shadingN);
+    double cosR = maxCosine(box, point.hit, R);
+    if (cosN == 0.0 and cosR == 0.0 and material.n > 0.0)
+        return 0.0;
 
-        // Compute dist. from shadow to light source, used to check if
-        // the intersected object is farther than the light
-        double distSL = (shadow.O - light->position).length();
+    double specular = material.n > 0.0 ? pow(cosR, material.n)
+                                       : numeric_limits<double>::infinity();
+    double matMax = max(max(point.matColor.r, point.matColor.g),
+                        point.matColor.b);
+    double powerMax = max(max(power.r, power.g), power.b);
+    return (material.kd * cosN * matMax + material.ks * specular) * powerMax;
+}
 
-        // No intersection was found for shadow ray or the light is closer than
-        // the intersection => the object does not have a shadow
-        if(!renderShadows || !obj_shadow || (hit_shadow.t > distSL)) {
+void Scene::selectLights(SurfacePoint const &point,
+                         vector<LightSample> &samples) const
+{
+    samples.clear();
 
-            // Add diffuse.
-            double diffuse = std::max(shadingN.dot(L), 0.0);
-            color += diffuse * material.kd * light->color * matColor;
+    // Few lights: the tree costs more than it saves.
+    bool sampled = lightSamples > 0 and lightSamples < lights.size();
+    if (not sampled and lightThreshold <= 0.0 and lights.size() <= 8)
+    {
+        for (unsigned light = 0; light != lights.size(); ++light)
+            samples.push_back(LightSample{light, 1.0});
+        return;
+    }
 
-            // Add specular.
-            Vector reflectDir = reflect(-L, shadingN);
-            double specAngle = std::max(reflectDir.dot(V), 0.0);
-            double specular = std::pow(specAngle, material.n);
+    Vector R = 2.0 * point.shadingN.dot(point.V) * point.shadingN - point.V;
+    auto importance = [&](AABB const &box, Color const &power)
+    {
+        return lightImportance(point, R, box, power);
+    };
 
-            color += specular * material.ks * light->color;
-        }
+    if (not sampled)
+    {
+        lightTree.select(importance, lightThreshold, [&](unsigned light)
+        {
+            samples.push_back(LightSample{light, 1.0});
+        });
+
+        // Keep the order of the scene file, so the colors add up the same.
+        sort(samples.begin(), samples.end(),
+             [](LightSample const &lhs, LightSample const &rhs)
+             {
+                 return lhs.light < rhs.light;
+             });
+        return;
     }
 
-    if (depth > 0 and material.isTransparent)
+    // Pick lightSamples lights, each weighed by the inverse of the chance
+    // to pick it: on average the sum is that of all lights.
+    for (unsigned sample = 0; sample != lightSamples; ++sample)
+    {
+        double u = hashRandom({point.hit.x, point.hit.y, point.hit.z}, sample);
+        unsigned light;
+        double probability;
+        if (lightTree.sample(importance, u, light, probability))
+            samples.push_back(
+                LightSample{light, 1.0 / (probability * lightSamples)});
+    }
+}
+
+double Scene::branchScale(Ray const &next, double throughput) const
+{
+    if (throughput >= minContribution)
+        return 1.0;
+    if (not russianRoulette)
+        return 0.0;
+
+    // Survive with a probability proportional to the throughput and make
+    // up for the rays that did not by weighing the survivors more. The
+    // outcome only depends on the ray, so it is the same for every thread,
+    // tile order and renderer.
+    double survival = throughput / minContribution;
+    return rayRandom(next) < survival ? 1.0 / survival : 0.0;
+}
+
+template <typename Emit>
+void Scene::spawnRays(Ray const &ray, SurfacePoint const &point,
+                      double throughput, Emit emit) const
+{
+    // Only pass on rays whose contribution to the pixel is large enough.
+    auto branch = [&](Ray const &next, double weight)
+    {
+        double scale = branchScale(next, throughput * weight);
+        if (scale > 0.0)
+            emit(next, weight * scale, throughput * weight * scale);
+    };
+
+    Material const &material = *point.material;
+    Vector const &N = point.N;
+    Vector const &V = point.V;
+    Vector const &shadingN = point.shadingN;
+
+    if (material.isTransparent)
     {
         // The object is transparent, and thus refracts and reflects light.
         // Use Schlick's approximation to determine the ratio between the two.
@@ -112,59 +496,792 @@ Color Scene::trace(Ray const &ray, unsigned depth)
 
         // Reflection ray
         Vector reflectionD = reflect(ray.D, shadingN);
-        Ray reflectionRay(hit_acne, reflectionD);
-        color += kr * trace(reflectionRay, depth-1);
+        branch(Ray(point.hit, reflectionD, epsilon), kr);
 
         // Refraction ray
         Vector refractionD;
-        // Avoid intersection by subtracting epsilon
-        hit_acne = hit - epsilon * shadingN;
         if (N.dot(V) >= 0) { // N and V go in the same direction => outside object
             refractionD = refract(ray.D, shadingN, 1.0, material.nt);
         } else { // N and V go in opposite directions => inside the object
             refractionD = refract(ray.D, shadingN, material.nt, 1.0);
         }
-        Ray refractionRay(hit_acne, refractionD);
-        color += kt * trace(refractionRay, depth-1);
-
+        branch(Ray(point.hit, refractionD, epsilon), kt);
     }
-    else if (depth > 0 and material.ks > 0.0)
+    else if (material.ks > 0.0)
     {
         // The object is not transparent, but opaque.
         Vector reflectionD = reflect(ray.D, shadingN);
-        Ray reflectionRay(hit_acne, reflectionD);
-        // Recursively trace a new ray in this direction with decresed depth
-        color += material.ks * trace(reflectionRay, depth-1);
+        branch(Ray(point.hit, reflectionD, epsilon), material.ks);
     }
+}
 
-    return color;
+bool Scene::render(Framebuffer &img, Snapshot const &snapshot,
+                   TileDone const &tileDone)
+{
+    auto start = chrono::steady_clock::now();
+    unsigned h = img.height();
+    Tile window = cropWindow(img.width(), h);
+
+    // Tracing is const and every pixel only depends on the scene, so the
+    // tiles can be rendered in any order and on any thread with identical
+    // results. Pixels outside the window are left as they are. A
+    // framebuffer stored in tiles is rendered in those.
+    unsigned size = img.tileSize() != 0 ? img.tileSize() : tileSize;
+    vector<Tile> tiles = makeTiles(window, size);
+    ThreadPool pool(numThreads);
+    vector<TraceContext> contexts(pool.size(), TraceContext(lights.size()));
+
+    // The settings lowered to meet a time budget are restored afterwards.
+    unsigned depth = recursionDepth;
+    unsigned factor = supersamplingFactor;
+    unsigned numLightSamples = lightSamples;
+    bool shadows = renderShadows;
+    bool finished = true;
+    if (timeBudget > 0.0)
+    {
+        planBudget(window, h, pool, timeBudget);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        finished = renderProgressive(img, tiles, pool, contexts, snapshot,
+                                     timeBudget - elapsed.count());
+    }
+    else if (progressive)
+        finished = renderProgressive(img, tiles, pool, contexts, snapshot,
+                                     numeric_limits<double>::infinity());
+    else if (adaptive and supersamplingFactor > ADAPTIVE_BASE)
+        renderAdaptive(img, tiles, pool, contexts);
+    else if (tileDone and not denoise)
+    {
+        // A row can only be passed on once all tiles covering it are done,
+        // so the tiles are rendered a row of tiles at a time.
+        stable_sort(tiles.begin(), tiles.end(),
+                    [](Tile const &lhs, Tile const &rhs)
+                    {
+                        return lhs.y0 < rhs.y0;
+                    });
+        finished = renderTiles(img, tiles, pool, contexts, tileDone);
+    }
+    else
+        finished = renderTiles(img, tiles, pool, contexts, TileDone());
+
+    if (denoise and finished)
+    {
+        FeatureBuffers features(window);
+        gatherFeatures(features, tiles, h, pool);
+        ::denoise(img, features, pool);
+    }
+
+    stats = RenderStats();
+    for (TraceContext const &context : contexts)
+        stats += context.stats;
+
+    recursionDepth = depth;
+    supersamplingFactor = factor;
+    lightSamples = numLightSamples;
+    renderShadows = shadows;
+    return finished;
+}
+
+RenderStats const &Scene::getStats() const
+{
+    return stats;
+}
+
+Color Scene::renderPixel(unsigned x, unsigned y, unsigned h,
+                         TraceContext &context) const
+{
+    Color col(0,0,0);
+
+    context.stats.primaryRays += supersamplingFactor * supersamplingFactor;
+    for (unsigned i=0; i < supersamplingFactor; i++) {
+        for (unsigned j=0; j < supersamplingFactor; j++) {
+            Color subcol = trace(primaryRay(x, y, i, j, h), recursionDepth,
+                                 context);
+            subcol.clamp();
+            col = col + subcol;
+        }
+    }
+    return col / (supersamplingFactor * supersamplingFactor);
+}
+
+void Scene::renderPackets(Tile const &tile, Framebuffer &img, unsigned h,
+                          TraceContext &context) const
+{
+    unsigned width = tile.x1 - tile.x0;
+
+    // The rays of a pixel's subpixels are nearly parallel, so they are
+    // packed together: pixel by pixel, in the same order as renderPixel
+    // adds them up, which keeps the result identical.
+    vector<Color> cols(width * (tile.y1 - tile.y0), Color(0, 0, 0));
+    vector<Ray> rays;
+    vector<unsigned> pixels;    // index into cols of every ray
+    rays.reserve(packetSize);
+    pixels.reserve(packetSize);
+
+    auto tracePacket = [&]()
+    {
+        context.stats.primaryRays += rays.size();
+        RayPacket packet;
+        for (Ray const &ray : rays)
+            packet.add(ray);
+
+        HitRecord closest[RayPacket::MAX_SIZE];
+        castPacket(packet, closest);
+
+        // Packets diverge after the first hit: shading continues per ray.
+        for (unsigned lane = 0; lane != rays.size(); ++lane)
+        {
+            Color subcol = shade(rays[lane], closest[lane].obj,
+                                 closest[lane].hit, recursionDepth, context);
+            subcol.clamp();
+            cols[pixels[lane]] = cols[pixels[lane]] + subcol;
+        }
+        rays.clear();
+        pixels.clear();
+    };
+
+    for (unsigned y = tile.y0; y < tile.y1; ++y)
+        for (unsigned x = tile.x0; x < tile.x1; ++x)
+            for (unsigned i=0; i < supersamplingFactor; i++)
+                for (unsigned j=0; j < supersamplingFactor; j++)
+                {
+                    rays.push_back(primaryRay(x, y, i, j, h));
+                    pixels.push_back((y - tile.y0) * width + (x - tile.x0));
+                    if (rays.size() == packetSize)
+                        tracePacket();
+                }
+    if (not rays.empty())
+        tracePacket();
+
+    for (unsigned y = tile.y0; y < tile.y1; ++y)
+        for (unsigned x = tile.x0; x < tile.x1; ++x)
+            img.put_pixel(x, y, cols[(y - tile.y0) * width + (x - tile.x0)]
+                                / (supersamplingFactor * supersamplingFactor));
 }
 
-void Scene::render(Image &img)
+void Scene::renderWavefront(Tile const &tile, Framebuffer &img, unsigned h,
+                            TraceContext &context) const
+{
+    unsigned width = tile.x1 - tile.x0;
+    unsigned samples = supersamplingFactor * supersamplingFactor;
+    auto getRay = [](WaveRay const &wave) -> Ray const & { return wave.ray; };
+
+    // All rays of the tile, every bounce after the previous one. The
+    // primary rays come first, pixel by pixel.
+    vector<WaveRay> rays;
+    for (unsigned y = tile.y0; y < tile.y1; ++y)
+        for (unsigned x = tile.x0; x < tile.x1; ++x)
+            for (unsigned i=0; i < supersamplingFactor; i++)
+                for (unsigned j=0; j < supersamplingFactor; j++)
+                    rays.push_back(WaveRay(primaryRay(x, y, i, j, h),
+                                           recursionDepth, 1.0));
+
+    context.stats.primaryRays += rays.size();
+
+    unsigned first = 0;
+    unsigned last = rays.size();
+    while (first != last)
+    {
+        // Intersect the bounce, in the order of the sorted rays.
+        vector<unsigned> order = sortRays(rays, first, last, bounds, getRay);
+        vector<HitRecord> hits(last - first);
+        for (unsigned idx : order)
+        {
+            pair<Object const *, Hit> mainhit = castRay(rays[idx].ray);
+            hits[idx - first].obj = mainhit.first;
+            hits[idx - first].hit = mainhit.second;
+        }
+
+        // Shade the hits grouped by object, thus by material.
+        vector<unsigned> shadeOrder;
+        for (unsigned idx : order)
+            if (hits[idx - first].obj)
+                shadeOrder.push_back(idx);
+        stable_sort(shadeOrder.begin(), shadeOrder.end(),
+                    [&](unsigned lhs, unsigned rhs)
+                    {
+                        return hits[lhs - first].obj < hits[rhs - first].obj;
+                    });
+
+        vector<SurfacePoint> points(last - first);
+        vector<ShadowRay> shadows;
+        vector<LightSample> samples;        // of all hits of the bounce
+        vector<unsigned> firstSample(last - first);  // samples of each hit
+        vector<unsigned> endSample(last - first);
+        vector<LightSample> pointSamples;
+        for (unsigned idx : shadeOrder)
+        {
+            unsigned hit = idx - first;
+            SurfacePoint &point = points[hit];
+            point = surfacePoint(rays[idx].ray, hits[hit].obj, hits[hit].hit);
+
+            // Add ambient once, regardless of the number of lights.
+            rays[idx].color = point.material->ka * point.matColor;
+
+            selectLights(point, pointSamples);
+            firstSample[hit] = samples.size();
+            for (LightSample const &sample : pointSamples)
+            {
+                if (renderShadows)
+                    shadows.push_back(ShadowRay{
+                        shadowRay(point, lights[sample.light]),
+                        static_cast<unsigned>(samples.size())});
+                samples.push_back(sample);
+            }
+            endSample[hit] = samples.size();
+
+            // rays grows below, so work on a copy of the ray.
+            Ray ray(rays[idx].ray);
+            if (rays[idx].depth > 0)
+                spawnRays(ray, point, rays[idx].throughput,
+                          [&](Ray const &next, double weight, double throughput)
+                {
+                    WaveRay &parent = rays[idx];
+                    parent.children[parent.numChildren] = rays.size();
+                    parent.weights[parent.numChildren] = weight;
+                    ++parent.numChildren;
+                    rays.push_back(WaveRay(next, parent.depth - 1, throughput));
+                });
+        }
+
+        // Test the shadow rays of the bounce, sorted as well.
+        vector<char> lit(samples.size(), 1);
+        auto getShadowRay = [](ShadowRay const &shadow) -> Ray const &
+        {
+            return shadow.ray;
+        };
+        for (unsigned idx : sortRays(shadows, 0, shadows.size(), bounds,
+                                     getShadowRay))
+            if (occluded(shadows[idx].ray,
+                         samples[shadows[idx].sample].light, context))
+                lit[shadows[idx].sample] = 0;
+
+        // Add diffuse and specular components, light by light as in shade().
+        for (unsigned idx : shadeOrder)
+        {
+            unsigned hit = idx - first;
+            for (unsigned sample = firstSample[hit];
+                 sample != endSample[hit]; ++sample)
+                if (lit[sample])
+                    illuminate(points[hit], lights[samples[sample].light],
+                               samples[sample].weight, rays[idx].color);
+        }
+
+        first = last;
+        last = rays.size();
+    }
+
+    // Children come after their parents: add their colors bottom up.
+    for (unsigned idx = rays.size(); idx-- > 0; )
+    {
+        WaveRay &wave = rays[idx];
+        for (unsigned child = 0; child != wave.numChildren; ++child)
+        {
+            Color const &childColor = rays[wave.children[child]].color;
+            wave.color += wave.weights[child] * childColor;
+        }
+    }
+
+    vector<Color> cols(width * (tile.y1 - tile.y0), Color(0, 0, 0));
+    for (unsigned idx = 0; idx != cols.size() * samples; ++idx)
+    {
+        Color subcol = rays[idx].color;
+        subcol.clamp();
+        cols[idx / samples] = cols[idx / samples] + subcol;
+    }
+
+    for (unsigned y = tile.y0; y < tile.y1; ++y)
+        for (unsigned x = tile.x0; x < tile.x1; ++x)
+            img.put_pixel(x, y, cols[(y - tile.y0) * width + (x - tile.x0)]
+                                / (supersamplingFactor * supersamplingFactor));
+}
+
+void Scene::renderAdaptive(Framebuffer &img, vector<Tile> const &tiles,
+                           ThreadPool &pool,
+                           vector<TraceContext> &contexts) const
 {
     unsigned w = img.width();
     unsigned h = img.height();
+    Tile window = cropWindow(w, h);
+    unsigned factor = supersamplingFactor;
+    unsigned const numBase = ADAPTIVE_BASE * ADAPTIVE_BASE;
+
+    // First pass: the initial samples of every pixel.
+    vector<PixelSamples> pixels(w * h);
+    pool.parallelFor(tiles.size(), [&](unsigned idx, unsigned thread)
+    {
+        Tile const &tile = tiles[idx];
+        TraceContext &context = contexts[thread];
+        for (unsigned y = tile.y0; y < tile.y1; ++y)
+            for (unsigned x = tile.x0; x < tile.x1; ++x)
+            {
+                PixelSamples &pixel = pixels[y * w + x];
+                pixel.uniform = true;
+                pixel.N = Vector(0.0, 0.0, 0.0);
+                for (unsigned k = 0; k != numBase; ++k)
+                {
+                    Object const *obj;
+                    Vector N;
+                    pixel.colors[k] = sample(x, y,
+                                             baseIndex(k / ADAPTIVE_BASE, factor),
+                                             baseIndex(k % ADAPTIVE_BASE, factor),
+                                             h, context, obj, N);
+                    if (k == 0)
+                        pixel.obj = obj;
+                    else if (obj != pixel.obj)
+                        pixel.uniform = false;
+                    pixel.N += N;
+                }
+                pixel.mean = Color(0.0, 0.0, 0.0);
+                for (Color const &color : pixel.colors)
+                    pixel.mean = pixel.mean + color;
+                pixel.mean = pixel.mean / numBase;
+                context.stats.primaryRays += numBase;
+            }
+    });
 
-    for (unsigned y = 0; y < h; ++y)
-        for (unsigned x = 0; x < w; ++x)
+    // Does the pixel need all samples?
+    auto needsRefinement = [&](unsigned x, unsigned y)
+    {
+        PixelSamples const &pixel = pixels[y * w + x];
+        if (not pixel.uniform)
+            return true;
+
+        // Standard deviation of the samples, per color channel
+        for (unsigned channel = 0; channel != 3; ++channel)
         {
-            Color col(0,0,0);
+            double variance = 0.0;
+            for (Color const &color : pixel.colors)
+            {
+                double diff = color.data[channel] - pixel.mean.data[channel];
+                variance += diff * diff;
+            }
+            if (variance / numBase > adaptiveThreshold * adaptiveThreshold)
+                return true;
+        }
 
-            for (unsigned i=0; i < supersamplingFactor; i++) {
-                for (unsigned j=0; j < supersamplingFactor; j++) {
-                    double sub = (double) 1 / (2*supersamplingFactor);
-                    //Point subpixel(x + sub,  h - 1 - y + sub, 0);
-                    Point subpixel(x + sub + (double) i/supersamplingFactor, h - y - (sub + (double) j/supersamplingFactor), 0);
-                    Ray ray(eye, (subpixel - eye).normalized());
-                    Color subcol = trace(ray, recursionDepth);
-                    subcol.clamp();
-                    col = col + subcol;
+        // An edge (also of a shadow or highlight) may also run between the
+        // samples of neighbouring pixels.
+        int const offsets[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+        for (auto const &offset : offsets)
+        {
+            int nx = static_cast<int>(x) + offset[0];
+            int ny = static_cast<int>(y) + offset[1];
+            if (nx < static_cast<int>(window.x0)
+                or ny < static_cast<int>(window.y0)
+                or nx >= static_cast<int>(window.x1)
+                or ny >= static_cast<int>(window.y1))
+                continue;
+
+            PixelSamples const &other = pixels[ny * w + nx];
+            if (not other.uniform or other.obj != pixel.obj)
+                return true;
+            for (unsigned channel = 0; channel != 3; ++channel)
+                if (abs(other.mean.data[channel] - pixel.mean.data[channel])
+                    > ADAPTIVE_CONTRAST * adaptiveThreshold)
+                    return true;
+            if (pixel.obj and pixel.N.normalized().dot(other.N.normalized())
+                              < ADAPTIVE_NORMAL_COS)
+                return true;
+        }
+        return false;
+    };
+
+    // Second pass: refine where needed. The colors are added in the order
+    // of renderPixel, so a refined pixel is exactly what it gives.
+    pool.parallelFor(tiles.size(), [&](unsigned idx, unsigned thread)
+    {
+        Tile const &tile = tiles[idx];
+        TraceContext &context = contexts[thread];
+        for (unsigned y = tile.y0; y < tile.y1; ++y)
+            for (unsigned x = tile.x0; x < tile.x1; ++x)
+            {
+                PixelSamples const &pixel = pixels[y * w + x];
+                Color col(0,0,0);
+                if (not needsRefinement(x, y))
+                {
+                    img.put_pixel(x, y, pixel.mean);
+                    continue;
                 }
+
+                ++context.stats.refinedPixels;
+                for (unsigned i=0; i < factor; i++) {
+                    for (unsigned j=0; j < factor; j++) {
+                        // Reuse the initial sample at this subpixel, if any.
+                        unsigned base = numBase;
+                        for (unsigned k = 0; k != numBase; ++k)
+                            if (baseIndex(k / ADAPTIVE_BASE, factor) == i and
+                                baseIndex(k % ADAPTIVE_BASE, factor) == j)
+                                base = k;
+
+                        Color subcol;
+                        if (base != numBase)
+                            subcol = pixel.colors[base];
+                        else
+                        {
+                            subcol = trace(primaryRay(x, y, i, j, h),
+                                           recursionDepth, context);
+                            subcol.clamp();
+                            ++context.stats.primaryRays;
+                        }
+                        col = col + subcol;
+                    }
+                }
+                img.put_pixel(x, y, col / (factor * factor));
+            }
+    });
+}
+
+void Scene::gatherFeatures(FeatureBuffers &features,
+                           vector<Tile> const &tiles, unsigned h,
+                           ThreadPool &pool) const
+{
+    unsigned factor = supersamplingFactor;
+
+    // Only the primary rays are cast again, at the same samples as the
+    // colors: much cheaper than shading them.
+    pool.parallelFor(tiles.size(), [&](unsigned idx, unsigned)
+    {
+        Tile const &tile = tiles[idx];
+        for (unsigned y = tile.y0; y < tile.y1; ++y)
+            for (unsigned x = tile.x0; x < tile.x1; ++x)
+            {
+                Vector normal(0.0, 0.0, 0.0);
+                Color albedo(0.0, 0.0, 0.0);
+                double depth = 0.0;
+                for (unsigned i=0; i < factor; i++)
+                    for (unsigned j=0; j < factor; j++)
+                    {
+                        Ray ray = primaryRay(x, y, i, j, h);
+                        pair<Object const *, Hit> mainhit = castRay(ray);
+                        if (not mainhit.first)
+                        {
+                            depth += FeatureBuffers::BACKGROUND_DEPTH;
+                            continue;
+                        }
+
+                        SurfacePoint point = surfacePoint(ray, mainhit.first,
+                                                          mainhit.second);
+                        normal += point.shadingN;
+                        albedo += point.matColor;
+                        depth += log(mainhit.second.t);
+                    }
+
+                unsigned pixel = (y - features.y0) * features.width
+                                 + x - features.x0;
+                features.normals[pixel] = normal / (factor * factor);
+                features.albedo[pixel] = albedo / (factor * factor);
+                features.depth[pixel] = depth / (factor * factor);
             }
-            col = col / (supersamplingFactor * supersamplingFactor);
-            img(x, y) = col;
+    });
+}
 
+bool Scene::renderTiles(Framebuffer &img, vector<Tile> const &tiles,
+                        ThreadPool &pool, vector<TraceContext> &contexts,
+                        TileDone const &tileDone) const
+{
+    unsigned w = img.width();
+    unsigned h = img.height();
+
+    // The pixels of a checkpoint are those of its finished tiles (and black
+    // elsewhere). Without a checkpoint file only the tiles are kept track
+    // of, so the image is the only full size buffer.
+    bool saving = not checkpointFile.empty();
+    Checkpoint checkpoint(checkpointKey(), saving ? w : 0, saving ? h : 0,
+                          tiles.size());
+    if (saving and checkpoint.load(checkpointFile))
+        for (Tile const &tile : tiles)
+            for (unsigned y = tile.y0; y < tile.y1; ++y)
+                for (unsigned x = tile.x0; x < tile.x1; ++x)
+                    img.put_pixel(x, y, checkpoint.pixels[y * w + x]);
+    if (tileDone)
+        for (unsigned idx = 0; idx != tiles.size(); ++idx)
+            if (checkpoint.tilesDone[idx])
+                tileDone(tiles[idx]);
+
+    // With checkpoints the tiles are rendered a few per thread at a time,
+    // saving in between when it is time to.
+    unsigned batch = saving ? 4 * pool.size() : tiles.size();
+    auto lastSave = chrono::steady_clock::now();
+    bool stopped = false;
+    for (unsigned first = 0; first < tiles.size() and not stopped;
+         first += batch)
+    {
+        unsigned count = min<unsigned>(batch, tiles.size() - first);
+        pool.parallelFor(count, [&](unsigned idx, unsigned thread)
+        {
+            if (checkpoint.tilesDone[first + idx] or stopRequested())
+                return;
+
+            Tile const &tile = tiles[first + idx];
+            TraceContext &context = contexts[thread];
+            if (wavefront)
+                renderWavefront(tile, img, h, context);
+            else if (packetSize > 1)
+                renderPackets(tile, img, h, context);
+            else
+            {
+                for (unsigned y = tile.y0; y < tile.y1; ++y)
+                    for (unsigned x = tile.x0; x < tile.x1; ++x)
+                        img.put_pixel(x, y, renderPixel(x, y, h, context));
+            }
+            checkpoint.tilesDone[first + idx] = 1;
+            img.release(tile);
+            if (tileDone)
+                tileDone(tile);
+        });
+        stopped = stopRequested();
+
+        chrono::duration<double> sinceSave =
+            chrono::steady_clock::now() - lastSave;
+        if (not saving
+            or (not stopped and sinceSave.count() < checkpointInterval))
+            continue;
+
+        for (Tile const &tile : tiles)
+            for (unsigned y = tile.y0; y < tile.y1; ++y)
+                for (unsigned x = tile.x0; x < tile.x1; ++x)
+                    checkpoint.pixels[y * w + x] = img.get_pixel(x, y);
+        checkpoint.save(checkpointFile);
+        lastSave = chrono::steady_clock::now();
+    }
+
+    bool finished = find(checkpoint.tilesDone.begin(),
+                         checkpoint.tilesDone.end(), 0)
+                    == checkpoint.tilesDone.end();
+    if (finished and saving)
+        remove(checkpointFile.c_str());
+    return finished;
+}
+
+bool Scene::renderProgressive(Framebuffer &img, vector<Tile> const &tiles,
+                              ThreadPool &pool,
+                              vector<TraceContext> &contexts,
+                              Snapshot const &snapshot,
+                              double timeLimit) const
+{
+    unsigned w = img.width();
+    unsigned h = img.height();
+    unsigned factor = supersamplingFactor;
+
+    // The checkpoint holds the sums of the samples so far. Samples are
+    // added in the order of renderPixel, so the final image is exactly what
+    // it gives.
+    Checkpoint checkpoint(checkpointKey(), w, h, tiles.size());
+    if (not checkpointFile.empty())
+        checkpoint.load(checkpointFile);
+    vector<Color> &sums = checkpoint.pixels;
+    vector<unsigned> &counts = checkpoint.counts;
+
+    // Pixels without samples yet stay black.
+    auto resolve = [&]()
+    {
+        for (Tile const &tile : tiles)
+            for (unsigned y = tile.y0; y < tile.y1; ++y)
+                for (unsigned x = tile.x0; x < tile.x1; ++x)
+                    img.put_pixel(x, y, counts[y * w + x] == 0
+                                        ? Color(0.0, 0.0, 0.0)
+                                        : sums[y * w + x] / counts[y * w + x]);
+    };
+
+    // With snapshots, checkpoints or a time limit a pass runs a few tiles
+    // per thread at a time, so the clock is checked often enough even if a
+    // pass takes long.
+    bool limited = timeLimit < numeric_limits<double>::infinity();
+    unsigned batch = snapshot or limited or not checkpointFile.empty()
+                     ? 4 * pool.size() : tiles.size();
+    auto start = chrono::steady_clock::now();
+    auto lastSnapshot = start;
+    auto lastSave = start;
+    unsigned numBatches = 0;
+    bool timeUp = false;
+    bool stopped = false;
+
+    for (unsigned pass = 0; pass != factor * factor and not timeUp
+                            and not stopped; ++pass)
+        for (unsigned first = 0; first < tiles.size(); first += batch)
+        {
+            // Once every pixel has a sample, stop before a batch that would
+            // not finish in time. The pixels count their own samples, so
+            // the last pass may be cut short.
+            chrono::duration<double> elapsed =
+                chrono::steady_clock::now() - start;
+            if (pass != 0 and elapsed.count() * (numBatches + 1) / numBatches
+                              > timeLimit)
+            {
+                timeUp = true;
+                break;
+            }
+            ++numBatches;
+
+            unsigned count = min<unsigned>(batch, tiles.size() - first);
+            pool.parallelFor(count, [&](unsigned idx, unsigned thread)
+            {
+                if (stopRequested())
+                    return;
+
+                // Pixels of a resumed render may be a pass ahead.
+                Tile const &tile = tiles[first + idx];
+                TraceContext &context = contexts[thread];
+                for (unsigned y = tile.y0; y < tile.y1; ++y)
+                    for (unsigned x = tile.x0; x < tile.x1; ++x)
+                    {
+                        if (counts[y * w + x] != pass)
+                            continue;
+
+                        Color subcol = trace(primaryRay(x, y, pass / factor,
+                                                        pass % factor, h),
+                                             recursionDepth, context);
+                        subcol.clamp();
+                        sums[y * w + x] = sums[y * w + x] + subcol;
+                        ++counts[y * w + x];
+                        ++context.stats.primaryRays;
+                    }
+            });
+            stopped = stopRequested();
+
+            auto now = chrono::steady_clock::now();
+            chrono::duration<double> sinceSave = now - lastSave;
+            if (not checkpointFile.empty()
+                and (stopped or sinceSave.count() >= checkpointInterval))
+            {
+                checkpoint.save(checkpointFile);
+                lastSave = now;
+            }
+            if (stopped)
+                break;
+
+            chrono::duration<double> sinceSnapshot = now - lastSnapshot;
+            if (not snapshot or sinceSnapshot.count() < previewInterval)
+                continue;
+
+            resolve();
+            snapshot(img);
+            lastSnapshot = chrono::steady_clock::now();
+        }
+
+    resolve();
+    bool finished = not stopped;
+    if (finished and not checkpointFile.empty())
+        remove(checkpointFile.c_str());
+    return finished;
+}
+
+double Scene::passCost(Tile const &window, unsigned h, ThreadPool &pool,
+                       double maxSeconds) const
+{
+    // Every PILOT_STRIDE-th pixel of every PILOT_STRIDE-th row, the rows in
+    // bit-reversed order so any number of them is spread over the window.
+    // Contexts of their own keep them out of the statistics.
+    unsigned const PILOT_STRIDE = 8;
+    unsigned width = window.x1 - window.x0;
+    unsigned height = window.y1 - window.y0;
+    unsigned numRows = (height + PILOT_STRIDE - 1) / PILOT_STRIDE;
+    unsigned numBits = 0;
+    while ((1u << numBits) < numRows)
+        ++numBits;
+
+    vector<unsigned> rows;
+    for (unsigned idx = 0; idx != 1u << numBits; ++idx)
+    {
+        unsigned row = 0;
+        for (unsigned bit = 0; bit != numBits; ++bit)
+            row |= ((idx >> bit) & 1) << (numBits - 1 - bit);
+        if (row < numRows)
+            rows.push_back(row);
+    }
+
+    vector<TraceContext> contexts(pool.size(), TraceContext(lights.size()));
+    vector<unsigned> numTraced(pool.size(), 0);
+    auto start = chrono::steady_clock::now();
+    pool.parallelFor(rows.size(), [&](unsigned idx, unsigned thread)
+    {
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        if (idx != 0 and elapsed.count() > maxSeconds)
+            return;
+
+        unsigned y = window.y0 + rows[idx] * PILOT_STRIDE;
+        for (unsigned x = window.x0; x < window.x1; x += PILOT_STRIDE)
+        {
+            trace(primaryRay(x, y, 0, 0, h), recursionDepth, contexts[thread]);
+            ++numTraced[thread];
         }
+    });
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    unsigned total = 0;
+    for (unsigned count : numTraced)
+        total += count;
+    return elapsed.count() * width * height / total;
+}
+
+void Scene::planBudget(Tile const &window, unsigned h, ThreadPool &pool,
+                       double timeLimit)
+{
+    // Costs vary from pass to pass, so plan with some time to spare. Each
+    // estimate may take a small part of the time.
+    double planned = 0.8 * timeLimit;
+    double pilotTime = 0.02 * timeLimit;
+
+    // At least one sample per pixel must fit: cut bounces first, then
+    // sample the lights instead of taking all of them, and as a last
+    // resort drop the shadows.
+    double cost = passCost(window, h, pool, pilotTime);
+    while (recursionDepth > 0 and cost > planned)
+    {
+        --recursionDepth;
+        cost = passCost(window, h, pool, pilotTime);
+    }
+    unsigned numLights = lightSamples == 0 ? lights.size() : lightSamples;
+    while (cost > planned and numLights > 1)
+    {
+        // Fewer lights save less than in proportion: repeat until it fits.
+        numLights = max(1u, min(numLights - 1, static_cast<unsigned>(
+                                                numLights * planned / cost)));
+        lightSamples = numLights;
+        cost = passCost(window, h, pool, pilotTime);
+    }
+    if (cost > planned and renderShadows)
+    {
+        renderShadows = false;
+        cost = passCost(window, h, pool, pilotTime);
+    }
+
+    // Then as many samples as fit, up to the factor of the scene file.
+    unsigned fit = static_cast<unsigned>(sqrt(planned / cost));
+    supersamplingFactor = max(1u, min(supersamplingFactor, fit));
+}
+
+Color Scene::sample(unsigned x, unsigned y, unsigned i, unsigned j,
+                    unsigned h, TraceContext &context, Object const *&obj,
+                    Vector &N) const
+{
+    Ray ray = primaryRay(x, y, i, j, h);
+    pair<Object const *, Hit> mainhit = castRay(ray);
+
+    obj = mainhit.first;
+    N = Vector(0.0, 0.0, 0.0);
+    if (obj)
+    {
+        Hit hit = mainhit.second;
+        obj->finalize(ray, hit);
+        N = hit.N;
+    }
+
+    Color col = shade(ray, mainhit.first, mainhit.second, recursionDepth,
+                      context);
+    col.clamp();
+    return col;
+}
+
+Ray Scene::primaryRay(unsigned x, unsigned y, unsigned i, unsigned j,
+                      unsigned h) const
+{
+    double u;
+    double v;
+    sampler->sample(x, y, i * supersamplingFactor + j,
+                    supersamplingFactor * supersamplingFactor, u, v);
+    Point subpixel(x + u, h - y - v, 0);
+    return Ray(eye, (subpixel - eye).normalized());
 }
 
 // --- Misc functions ----------------------------------------------------------
@@ -172,22 +1289,41 @@ void Scene::render(Image &img)
 // Defaults
 Scene::Scene()
 :
+    arena(),
     objects(),
     lights(),
     eye(),
     renderShadows(false),
     recursionDepth(0),
-    supersamplingFactor(1)
+    supersamplingFactor(1),
+    sampler(new GridSampler()),
+    numThreads(0),
+    tileSize(16),
+    packetSize(1),
+    wavefront(false),
+    minContribution(0.0),
+    russianRoulette(false),
+    lightThreshold(0.0),
+    lightSamples(0),
+    adaptive(false),
+    adaptiveThreshold(0.01),
+    progressive(false),
+    previewInterval(5.0),
+    denoise(false),
+    timeBudget(0.0),
+    checkpointFile(),
+    sceneKey(0),
+    checkpointInterval(60.0),
+    stopFlag(nullptr),
+    cropX(0),
+    cropY(0),
+    cropWidth(0),
+    cropHeight(0)
 {}
 
-void Scene::addObject(ObjectPtr obj)
-{
-    objects.push_back(obj);
-}
-
 void Scene::addLight(Light const &light)
 {
-    lights.push_back(LightPtr(new Light(light)));
+    lights.push_back(light);
 }
 
 void Scene::setEye(Triple const &position)
@@ -195,12 +1331,12 @@ void Scene::setEye(Triple const &position)
     eye = position;
 }
 
-unsigned Scene::getNumObject()
+unsigned Scene::getNumObject() const
 {
     return objects.size();
 }
 
-unsigned Scene::getNumLights()
+unsigned Scene::getNumLights() const
 {
     return lights.size();
 }
@@ -219,3 +1355,145 @@ void Scene::setSuperSample(unsigned factor)
 {
     supersamplingFactor = factor;
 }
+
+void Scene::setSampler(unique_ptr<Sampler> pixelSampler)
+{
+    sampler = move(pixelSampler);
+}
+
+void Scene::setThreads(unsigned threads)
+{
+    numThreads = threads;
+}
+
+void Scene::setTileSize(unsigned size)
+{
+    tileSize = size;
+}
+
+void Scene::setPacketSize(unsigned size)
+{
+    if (size == 0)
+        size = 1;
+    if (size > RayPacket::MAX_SIZE)
+        size = RayPacket::MAX_SIZE;
+    packetSize = size;
+}
+
+void Scene::setWavefront(bool enabled)
+{
+    wavefront = enabled;
+}
+
+void Scene::setMinContribution(double threshold)
+{
+    minContribution = threshold;
+}
+
+void Scene::setRussianRoulette(bool enabled)
+{
+    russianRoulette = enabled;
+}
+
+void Scene::setLightThreshold(double threshold)
+{
+    lightThreshold = threshold;
+}
+
+void Scene::setLightSamples(unsigned count)
+{
+    lightSamples = count;
+}
+
+void Scene::setAdaptive(bool enabled)
+{
+    adaptive = enabled;
+}
+
+void Scene::setAdaptiveThreshold(double threshold)
+{
+    adaptiveThreshold = threshold;
+}
+
+void Scene::setProgressive(bool enabled)
+{
+    progressive = enabled;
+}
+
+void Scene::setPreviewInterval(double seconds)
+{
+    previewInterval = seconds;
+}
+
+void Scene::setDenoise(bool enabled)
+{
+    denoise = enabled;
+}
+
+void Scene::setTimeBudget(double seconds)
+{
+    timeBudget = seconds;
+}
+
+void Scene::setCheckpoint(string const &filename, uint64_t key)
+{
+    checkpointFile = filename;
+    sceneKey = key;
+}
+
+void Scene::setCheckpointInterval(double seconds)
+{
+    checkpointInterval = seconds;
+}
+
+void Scene::setStopFlag(atomic<bool> const *flag)
+{
+    stopFlag = flag;
+}
+
+void Scene::setCrop(unsigned x, unsigned y, unsigned width, unsigned height)
+{
+    cropX = x;
+    cropY = y;
+    cropWidth = width;
+    cropHeight = height;
+}
+
+Tile Scene::cropWindow(unsigned w, unsigned h) const
+{
+    if (cropWidth == 0 or cropHeight == 0)
+        return Tile{0, 0, w, h};
+
+    // Clamped to the image, at least one pixel
+    Tile window;
+    window.x0 = min(cropX, w - 1);
+    window.y0 = min(cropY, h - 1);
+    window.x1 = window.x0 + min(cropWidth, w - window.x0);
+    window.y1 = window.y0 + min(cropHeight, h - window.y0);
+    return window;
+}
+
+bool Scene::stopRequested() const
+{
+    return stopFlag and *stopFlag;
+}
+
+uint64_t Scene::checkpointKey() const
+{
+    // The scene file, the settings a time budget may change and the crop
+    // window (which decides the tiles)
+    uint64_t key = sceneKey;
+    for (uint64_t value : {uint64_t(supersamplingFactor),
+                           uint64_t(recursionDepth), uint64_t(lightSamples),
+                           uint64_t(renderShadows), uint64_t(cropX),
+                           uint64_t(cropY), uint64_t(cropWidth),
+                           uint64_t(cropHeight)})
+    {
+        // splitmix64
+        key += value + 0x9E3779B97F4A7C15ULL;
+        key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+        key ^= key >> 31;
+    }
+    return key;
+}
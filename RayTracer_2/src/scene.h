@@ -1,54 +1,331 @@
 #ifndef SCENE_H_
 #define SCENE_H_
 
+#include "aabb.h"
+#include "arena.h"
 #include "light.h"
+#include "lighttree.h"
 #include "object.h"
+#include "packet.h"
+#include "primitives.h"
+#include "sampler.h"
+#include "tiles.h"
+#include "tracecontext.h"
 #include "triple.h"
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 #include <utility>
 
 // Forward declarations
 class Ray;
-class Image;
+struct FeatureBuffers;
+class Framebuffer;
+class Material;
+class ThreadPool;
 
 class Scene
 {
-    std::vector<ObjectPtr> objects;
-    std::vector<LightPtr> lights;
+    ObjectArena arena;              // owns all objects
+    std::vector<Object *> objects;  // in the order they were added
+    std::vector<Light> lights;
+    LightTree lightTree;            // over the lights, built by buildBVH()
+
+    // The objects grouped by type, each group with its own BVH. Built by
+    // buildBVH(), used for all ray queries.
+    SphereSet spheres;
+    QuadSet quads;
+    ObjectSet others;
+    AABB bounds;                    // of all objects and the eye
     Point eye;
     bool renderShadows;
     unsigned recursionDepth;
-    unsigned supersamplingFactor;
+    unsigned supersamplingFactor;   // squared: samples per pixel
+    std::unique_ptr<Sampler> sampler;   // places them in the pixel
+    unsigned numThreads;            // 0: one per hardware thread
+    unsigned tileSize;              // width and height of a render tile
+    unsigned packetSize;            // primary rays per packet, 1: no packets
+    bool wavefront;                 // render bounce by bounce (see below)
+
+    // Reflection and refraction rays contributing less than minContribution
+    // to their pixel are not traced, or with russianRoulette only some of
+    // them, with their color scaled up accordingly.
+    double minContribution;
+    bool russianRoulette;
+
+    RenderStats stats;              // of the last render
+
+    // Lights that may add more than lightThreshold to a shading point are
+    // taken into account (with 0 only those that cannot add anything are
+    // skipped). With lightSamples > 0 only that many lights are picked per
+    // point instead, at random but in proportion to what they may add.
+    double lightThreshold;
+    unsigned lightSamples;
+
+    // Adaptive supersampling: every pixel starts with 2 x 2 of the
+    // supersamplingFactor x supersamplingFactor subpixels. Only pixels at
+    // an edge (different objects or normals among their samples or those
+    // of their neighbours) or with samples differing more than
+    // adaptiveThreshold (standard deviation) get the rest.
+    bool adaptive;
+    double adaptiveThreshold;
+
+    // Progressive rendering: one sample per pixel over the whole image at a
+    // time, summed in a buffer. At least every previewInterval seconds the
+    // image so far is handed to the snapshot function of render().
+    bool progressive;
+    double previewInterval;
 
-    // Offset multiplier. Before casting a new ray from a hit point,
-    // move the hit point in the direction of the normal with this offset
-    // to prevent finding an intersection with the same object due to
-    // floating point inaccuracies. This prevents shadow acne, among other problems.
+    bool denoise;                   // filter the image after rendering
+
+    // With a time budget (seconds, 0: none) render() lowers the recursion
+    // depth, the number of lights per point, the shadows and the
+    // supersampling factor until an estimate of the render fits, then
+    // renders progressively and stops when time runs out.
+    double timeBudget;
+
+    // Checkpoints: with a checkpointFile, render() saves what it finished
+    // (tiles, or the samples of a progressive render) every
+    // checkpointInterval seconds, and a later render of the same scene
+    // (sceneKey) and settings carries on from it. Setting *stopFlag makes
+    // render() stop soon, saving a checkpoint first.
+    std::string checkpointFile;
+    uint64_t sceneKey;
+    double checkpointInterval;
+    std::atomic<bool> const *stopFlag;
+
+    // Crop window: with a cropWidth and cropHeight, render() only renders
+    // the pixels in [cropX, cropX + cropWidth) x [cropY, cropY + cropHeight)
+    // of the image, which are exactly those of the whole image.
+    unsigned cropX;
+    unsigned cropY;
+    unsigned cropWidth;
+    unsigned cropHeight;
+
+    // Secondary rays (shadow, reflection, refraction) start at the hit point
+    // but only accept hits beyond this distance (their tMin). This prevents
+    // finding an intersection with the same object due to floating point
+    // inaccuracies, i.e. shadow acne, among other problems.
     double const epsilon = 1E-3;
 
+    // What shading needs to know about the closest hit of a ray
+    struct SurfacePoint
+    {
+        Material const *material;
+        Point hit;
+        Vector V;                   // towards the viewer
+        Vector N;                   // normal, outwards for closed objects
+        Vector shadingN;            // normal on the side of V
+        Color matColor;             // of the material or its texture
+    };
+
+    // A light to shade a point with, and the weight of its contribution
+    struct LightSample
+    {
+        unsigned light;             // index into lights
+        double weight;
+    };
+
     public:
         Scene();
 
-        // determine closest hit (if any)
-        std::pair<ObjectPtr, Hit> castRay(Ray const &ray) const;
+        // sort the objects into per-type groups and build their BVHs,
+        // must be called after the last object was added and before rendering
+        void buildBVH();
+
+        // determine closest hit (if any), the object is nullptr on a miss
+        std::pair<Object const *, Hit> castRay(Ray const &ray) const;
+
+        // castRay for all rays of the packet at once, closest[lane] receives
+        // the hit of the ray in that lane
+        void castPacket(RayPacket &packet, HitRecord *closest) const;
+
+        // is there any object hit by the ray within [ray.tMin, ray.tMax]?
+        bool occluded(Ray const &ray) const;
+
+        // any object hit by the ray within [ray.tMin, ray.tMax], nullptr if
+        // there is none
+        Object const *occluder(Ray const &ray) const;
+
+        // occluded() for a shadow ray towards the given light, trying the
+        // thread's last occluder of that light first
+        bool occluded(Ray const &ray, unsigned light,
+                      TraceContext &context) const;
+
+        // trace a ray into the scene and return the color, throughput is
+        // the weight of that color in the pixel
+        Color trace(Ray const &ray, unsigned depth, TraceContext &context,
+                    double throughput = 1.0) const;
+
+        // color seen along the ray, given its closest hit (obj is nullptr
+        // on a miss); secondary rays are traced one by one
+        Color shade(Ray const &ray, Object const *obj, Hit hit,
+                    unsigned depth, TraceContext &context,
+                    double throughput = 1.0) const;
+
+        // the building blocks of shade(), shared with renderWavefront()
+        SurfacePoint surfacePoint(Ray const &ray, Object const *obj,
+                                  Hit hit) const;
+        Ray shadowRay(SurfacePoint const &point, Light const &light) const;
+
+        // add the diffuse and specular light the point receives from light,
+        // times weight, to color
+        void illuminate(SurfacePoint const &point, Light const &light,
+                        double weight, Color &color) const;
+
+        // the lights to shade the point with (see lightThreshold)
+        void selectLights(SurfacePoint const &point,
+                          std::vector<LightSample> &samples) const;
 
-        // trace a ray into the scene and return the color
-        Color trace(Ray const &ray, unsigned depth);
+        // upper bound of the light the point receives from lights in box
+        // with a total color of power, R being the mirrored view direction
+        double lightImportance(SurfacePoint const &point, Vector const &R,
+                               AABB const &box, Color const &power) const;
 
-        // render the scene to the given image
-        void render(Image &img);
+        // calls emit(ray, weight, throughput) for the reflection and
+        // refraction rays leaving the point that are worth tracing, in the
+        // order their colors are added; throughput is that of ray
+        template <typename Emit>
+        void spawnRays(Ray const &ray, SurfacePoint const &point,
+                       double throughput, Emit emit) const;
 
+        // factor of the color of a ray with the given throughput, 0 if it
+        // is not traced (see minContribution)
+        double branchScale(Ray const &next, double throughput) const;
+
+        // Called with the image so far during a progressive render
+        typedef std::function<void(Framebuffer const &img)> Snapshot;
+
+        // Called, from any thread, with each tile whose pixels are final
+        typedef std::function<void(Tile const &tile)> TileDone;
+
+        // render the scene to the given image, returns false if it was
+        // stopped early (see stopFlag). Only a plain tile by tile render
+        // without denoising calls tileDone; its pixels are all final once
+        // render() returns.
+        bool render(Framebuffer &img, Snapshot const &snapshot = Snapshot(),
+                    TileDone const &tileDone = TileDone());
+
+        // counters of the last render
+        RenderStats const &getStats() const;
+
+        // color of pixel (x, y) of an image with height h
+        Color renderPixel(unsigned x, unsigned y, unsigned h,
+                          TraceContext &context) const;
+
+        // the same for all pixels of the tile, tracing the primary rays in
+        // packets of packetSize
+        void renderPackets(Tile const &tile, Framebuffer &img, unsigned h,
+                           TraceContext &context) const;
+
+        // The same image as render(), but instead of following each
+        // pixel's rays depth first, all rays of the tile are handled one
+        // bounce at a time: every bounce is sorted by origin and direction,
+        // intersected, and shaded grouped by object. Shadow rays are
+        // collected and tested the same way. The colors are combined at
+        // the end in the order trace() adds them.
+        void renderWavefront(Tile const &tile, Framebuffer &img, unsigned h,
+                             TraceContext &context) const;
+
+        // render() with adaptive supersampling
+        void renderAdaptive(Framebuffer &img, std::vector<Tile> const &tiles,
+                            ThreadPool &pool,
+                            std::vector<TraceContext> &contexts) const;
+
+        // the features of every pixel, for the denoiser
+        void gatherFeatures(FeatureBuffers &features,
+                            std::vector<Tile> const &tiles, unsigned h,
+                            ThreadPool &pool) const;
+
+        // render() tile by tile, returns whether all were finished
+        bool renderTiles(Framebuffer &img, std::vector<Tile> const &tiles,
+                         ThreadPool &pool, std::vector<TraceContext> &contexts,
+                         TileDone const &tileDone) const;
+
+        // render() in progressive mode, taking at most about timeLimit
+        // seconds after the first sample of every pixel
+        bool renderProgressive(Framebuffer &img, std::vector<Tile> const &tiles,
+                               ThreadPool &pool,
+                               std::vector<TraceContext> &contexts,
+                               Snapshot const &snapshot,
+                               double timeLimit) const;
+
+        // estimated seconds to trace one sample of every pixel in the
+        // window of an image with height h, from tracing a few of them for
+        // about maxSeconds
+        double passCost(Tile const &window, unsigned h, ThreadPool &pool,
+                        double maxSeconds) const;
+
+        // choose the recursion depth, light samples, shadows and
+        // supersampling factor to render the window within timeLimit
+        // seconds
+        void planBudget(Tile const &window, unsigned h, ThreadPool &pool,
+                        double timeLimit);
+
+        bool stopRequested() const;
+
+        // identifies the scene and settings of a checkpoint
+        uint64_t checkpointKey() const;
+
+        // clamped color of the primary ray through subpixel (i, j) of pixel
+        // (x, y); obj and N receive the object it hits and its normal there
+        Color sample(unsigned x, unsigned y, unsigned i, unsigned j,
+                     unsigned h, TraceContext &context, Object const *&obj,
+                     Vector &N) const;
+
+        // primary ray through sample i * supersamplingFactor + j of pixel
+        // (x, y), in subpixel (i, j) of the grid sampler
+        Ray primaryRay(unsigned x, unsigned y, unsigned i, unsigned j,
+                       unsigned h) const;
+
+
+        // construct a new Shape(args...) owned by the scene
+        template <typename Shape, typename... Args>
+        Shape *addObject(Args &&...args);
 
-        void addObject(ObjectPtr obj);
         void addLight(Light const &light);
         void setEye(Triple const &position);
         void setRenderShadows(bool renderShadows);
         void setRecursionDepth(unsigned depth);
         void setSuperSample(unsigned factor);
+        void setSampler(std::unique_ptr<Sampler> pixelSampler);
+        void setThreads(unsigned threads);
+        void setTileSize(unsigned size);
+        void setPacketSize(unsigned size);
+        void setWavefront(bool enabled);
+        void setMinContribution(double threshold);
+        void setRussianRoulette(bool enabled);
+        void setLightThreshold(double threshold);
+        void setLightSamples(unsigned count);
+        void setAdaptive(bool enabled);
+        void setAdaptiveThreshold(double threshold);
+        void setProgressive(bool enabled);
+        void setPreviewInterval(double seconds);
+        void setDenoise(bool enabled);
+        void setTimeBudget(double seconds);
+        void setCheckpoint(std::string const &filename, uint64_t key);
+        void setCheckpointInterval(double seconds);
+        void setStopFlag(std::atomic<bool> const *flag);
+        void setCrop(unsigned x, unsigned y, unsigned width, unsigned height);
+
+        // the pixels of a w x h image render() renders: the crop window
+        // clamped to the image, or all of them
+        Tile cropWindow(unsigned w, unsigned h) const;
 
-        unsigned getNumObject();
-        unsigned getNumLights();
+        unsigned getNumObject() const;
+        unsigned getNumLights() const;
 };
 
+template <typename Shape, typename... Args>
+Shape *Scene::addObject(Args &&...args)
+{
+    Shape *obj = arena.create<Shape>(std::forward<Args>(args)...);
+    objects.push_back(obj);
+    return obj;
+}
+
 #endif
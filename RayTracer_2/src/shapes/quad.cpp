@@ -7,7 +7,7 @@
  *  First find the intersection with the plane the quad is in,
  *  then determine whether the point of intersection is within the quad.
  */
-Hit Quad::intersect(Ray const &ray)
+Hit Quad::intersect(Ray const &ray) const
 {
     // Catch the case where the ray is parallel to the plane, i.e. no intersection.
     double DdotN = (-ray.D).dot(N);
@@ -17,7 +17,8 @@ Hit Quad::intersect(Ray const &ray)
     // Find the point of intersection with the plane.
     double t = -N.dot(ray.O - v0) / N.dot(ray.D);
 
-    if (t < 0.0)
+    // Reject on distance before doing the inside test.
+    if (not ray.inRange(t))
         return Hit::NO_HIT();
 
     Point hit = ray.at(t);
@@ -25,19 +26,48 @@ Hit Quad::intersect(Ray const &ray)
     // Determine if the hit is inside of the quad.
     double u = (hit - v0).dot(v1 - v0);
     double v = (hit - v0).dot(v3 - v0);
-    if (0.0 <= u and u <= (v1 - v0).length_2() and
-        0.0 <= v and v <= (v3 - v0).length_2())
-        return Hit(t, N);
+    double uMax = (v1 - v0).length_2();
+    double vMax = (v3 - v0).length_2();
+    if (0.0 <= u and u <= uMax and
+        0.0 <= v and v <= vMax)
+        return Hit(t, u / uMax, v / vMax);  // (u, v) in [0, 1]^2
 
     return Hit::NO_HIT();
 }
 
-Vector Quad::toUV(Point const &hit)
+bool Quad::occluded(Ray const &ray) const
 {
-    double u = (hit - v0).dot(v1 - v0) / (v1 - v0).length_2();
-    double v = (hit - v0).dot(v3 - v0) / (v3 - v0).length_2();
+    double DdotN = (-ray.D).dot(N);
+    if (std::abs(DdotN) < std::numeric_limits<double>::epsilon())
+        return false;
+
+    // Reject on distance before doing the inside test.
+    double t = -N.dot(ray.O - v0) / N.dot(ray.D);
+    if (not ray.inRange(t))
+        return false;
 
-    return Vector(u, v, 0.0);
+    Point hit = ray.at(t);
+    double u = (hit - v0).dot(v1 - v0);
+    double v = (hit - v0).dot(v3 - v0);
+    return 0.0 <= u and u <= (v1 - v0).length_2() and
+           0.0 <= v and v <= (v3 - v0).length_2();
+}
+
+void Quad::finalize(Ray const &ray, Hit &hit) const
+{
+    // intersect() already found the coordinates within the quad
+    hit.N = N;
+    hit.uv = Vector(hit.u, hit.v, 0.0);
+}
+
+AABB Quad::boundingBox() const
+{
+    AABB box;
+    box.extend(v0);
+    box.extend(v1);
+    box.extend(v2);
+    box.extend(v3);
+    return box;
 }
 
 Quad::Quad(Point const &v0,
@@ -11,8 +11,10 @@ class Quad: public Object
              Point const &v2,
              Point const &v3);
 
-        Hit intersect(Ray const &ray) override;
-        Vector toUV(Point const &hit) override;
+        Hit intersect(Ray const &ray) const override;
+        bool occluded(Ray const &ray) const override;
+        void finalize(Ray const &ray, Hit &hit) const override;
+        AABB boundingBox() const override;
 
         Point const v0;
         Point const v1;
@@ -5,7 +5,7 @@
 
 using namespace std;
 
-Hit Sphere::intersect(Ray const &ray)
+Hit Sphere::intersect(Ray const &ray) const
 {
     // Sphere formula: ||x - position||^2 = r^2
     // Line formula:   x = ray.O + t * ray.D
@@ -21,31 +21,56 @@ Hit Sphere::intersect(Ray const &ray)
         return Hit::NO_HIT();
 
     // t0 is closest hit
-    if (t0 < 0.0)  // check if it is not behind the camera
+    if (not ray.inRange(t0))  // check if it is within the ray's interval
     {
         t0 = t1;    // try t1
-        if (t0 < 0.0) // both behind the camera
+        if (not ray.inRange(t0)) // both outside of the interval
             return Hit::NO_HIT();
     }
 
+    // The normal is calculated in finalize(), for the closest hit only.
+    return Hit(t0);
+}
+
+bool Sphere::occluded(Ray const &ray) const
+{
+    // Same as intersect(), but any root within the interval will do
+    Vector L = ray.O - position;
+    double a = ray.D.dot(ray.D);
+    double b = 2.0 * ray.D.dot(L);
+    double c = L.dot(L) - r * r;
+
+    double t0;
+    double t1;
+    if (not Solvers::quadratic(a, b, c, t0, t1))
+        return false;
+
+    return ray.inRange(t0) or ray.inRange(t1);
+}
+
+void Sphere::finalize(Ray const &ray, Hit &hit) const
+{
     // calculate normal
-    Point hit = ray.at(t0);
-    Vector N = (hit - position).normalized();
+    Vector relative = ray.at(hit.t) - position;
+    hit.N = relative.normalized();
 
     // Note that the direction of the normal is not changed here,
     // but in scene.cpp - if necessary.
 
-    return Hit(t0, N);
-}
+    if (not material.hasTexture)
+        return;
 
-Vector Sphere::toUV(Point const &hit)
-{
-    Vector relative = (hit - position);
     double u = 0.5 + atan2(relative.y, relative.x) / (2 * PI);
     double v = 1 - acos(relative.z/r) / PI;
 
     // Use a Vector to return 2 doubles. The third value is never read.
-    return Vector{u, v, 0.0};
+    hit.uv = Vector{u, v, 0.0};
+}
+
+AABB Sphere::boundingBox() const
+{
+    Vector extent(r, r, r);
+    return AABB(position - extent, position + extent);
 }
 
 Sphere::Sphere(Point const &pos, double radius, Vector const& axis, double angle)
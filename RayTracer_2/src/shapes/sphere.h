@@ -11,8 +11,10 @@ class Sphere: public Object
         Sphere(Point const &pos, double radius,
                Vector const& axis = Vector(0.0, 1.0, 0.0), double angle = 0.0);
 
-        Hit intersect(Ray const &ray) override;
-        Vector toUV(Point const &hit) override;
+        Hit intersect(Ray const &ray) const override;
+        bool occluded(Ray const &ray) const override;
+        void finalize(Ray const &ray, Hit &hit) const override;
+        AABB boundingBox() const override;
 
         Point const position;
         double const r;
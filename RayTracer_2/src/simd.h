@@ -0,0 +1,171 @@
+
+#ifndef SIMD_H_
+#define SIMD_H_
+
+// Thin wrapper around the vector registers of the target. A simd::Lanes
+// holds simd::WIDTH doubles, a simd::Mask the outcome of comparing two of
+// them lane by lane. AVX processes four doubles at once, SSE2 two; without
+// either the code falls back to plain scalars (WIDTH 1).
+//
+// Every operation rounds exactly like its scalar counterpart, and the
+// comparisons are false for NaN just like the built-in operators, so a
+// kernel written with these produces the same bits as the scalar code.
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <cmath>
+
+namespace simd
+{
+#if defined(__AVX__)
+
+    unsigned const WIDTH = 4;
+
+    struct Lanes { __m256d v; };
+    struct Mask  { __m256d v; };
+
+    inline Lanes load(double const *src)  { return {_mm256_loadu_pd(src)}; }
+    inline void store(double *dst, Lanes a) { _mm256_storeu_pd(dst, a.v); }
+    inline Lanes broadcast(double value)  { return {_mm256_set1_pd(value)}; }
+
+    inline Lanes operator+(Lanes a, Lanes b) { return {_mm256_add_pd(a.v, b.v)}; }
+    inline Lanes operator-(Lanes a, Lanes b) { return {_mm256_sub_pd(a.v, b.v)}; }
+    inline Lanes operator*(Lanes a, Lanes b) { return {_mm256_mul_pd(a.v, b.v)}; }
+    inline Lanes operator/(Lanes a, Lanes b) { return {_mm256_div_pd(a.v, b.v)}; }
+    inline Lanes operator-(Lanes a)
+    {
+        return {_mm256_xor_pd(a.v, _mm256_set1_pd(-0.0))};
+    }
+    inline Lanes sqrt(Lanes a) { return {_mm256_sqrt_pd(a.v)}; }
+    inline Lanes abs(Lanes a)
+    {
+        return {_mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v)};
+    }
+
+    inline Mask operator<(Lanes a, Lanes b)  { return {_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ)}; }
+    inline Mask operator<=(Lanes a, Lanes b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ)}; }
+    inline Mask operator>(Lanes a, Lanes b)  { return {_mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ)}; }
+    inline Mask operator==(Lanes a, Lanes b) { return {_mm256_cmp_pd(a.v, b.v, _CMP_EQ_OQ)}; }
+    inline Mask isnan(Lanes a) { return {_mm256_cmp_pd(a.v, a.v, _CMP_UNORD_Q)}; }
+
+    inline Mask operator&(Mask a, Mask b) { return {_mm256_and_pd(a.v, b.v)}; }
+    inline Mask operator|(Mask a, Mask b) { return {_mm256_or_pd(a.v, b.v)}; }
+    inline Mask operator!(Mask a)
+    {
+        return {_mm256_xor_pd(a.v, _mm256_cmp_pd(a.v, a.v, _CMP_TRUE_UQ))};
+    }
+
+    // mask ? a : b, lane by lane
+    inline Lanes select(Mask mask, Lanes a, Lanes b)
+    {
+        return {_mm256_blendv_pd(b.v, a.v, mask.v)};
+    }
+
+    // Bit i is set if lane i of the mask is.
+    inline unsigned bits(Mask mask) { return _mm256_movemask_pd(mask.v); }
+
+#elif defined(__SSE2__)
+
+    unsigned const WIDTH = 2;
+
+    struct Lanes { __m128d v; };
+    struct Mask  { __m128d v; };
+
+    inline Lanes load(double const *src)  { return {_mm_loadu_pd(src)}; }
+    inline void store(double *dst, Lanes a) { _mm_storeu_pd(dst, a.v); }
+    inline Lanes broadcast(double value)  { return {_mm_set1_pd(value)}; }
+
+    inline Lanes operator+(Lanes a, Lanes b) { return {_mm_add_pd(a.v, b.v)}; }
+    inline Lanes operator-(Lanes a, Lanes b) { return {_mm_sub_pd(a.v, b.v)}; }
+    inline Lanes operator*(Lanes a, Lanes b) { return {_mm_mul_pd(a.v, b.v)}; }
+    inline Lanes operator/(Lanes a, Lanes b) { return {_mm_div_pd(a.v, b.v)}; }
+    inline Lanes operator-(Lanes a)
+    {
+        return {_mm_xor_pd(a.v, _mm_set1_pd(-0.0))};
+    }
+    inline Lanes sqrt(Lanes a) { return {_mm_sqrt_pd(a.v)}; }
+    inline Lanes abs(Lanes a)
+    {
+        return {_mm_andnot_pd(_mm_set1_pd(-0.0), a.v)};
+    }
+
+    inline Mask operator<(Lanes a, Lanes b)  { return {_mm_cmplt_pd(a.v, b.v)}; }
+    inline Mask operator<=(Lanes a, Lanes b) { return {_mm_cmple_pd(a.v, b.v)}; }
+    inline Mask operator>(Lanes a, Lanes b)  { return {_mm_cmpgt_pd(a.v, b.v)}; }
+    inline Mask operator==(Lanes a, Lanes b) { return {_mm_cmpeq_pd(a.v, b.v)}; }
+    inline Mask isnan(Lanes a) { return {_mm_cmpunord_pd(a.v, a.v)}; }
+
+    inline Mask operator&(Mask a, Mask b) { return {_mm_and_pd(a.v, b.v)}; }
+    inline Mask operator|(Mask a, Mask b) { return {_mm_or_pd(a.v, b.v)}; }
+    inline Mask operator!(Mask a)
+    {
+        return {_mm_xor_pd(a.v, _mm_castsi128_pd(_mm_set1_epi32(-1)))};
+    }
+
+    // mask ? a : b, lane by lane
+    inline Lanes select(Mask mask, Lanes a, Lanes b)
+    {
+        return {_mm_or_pd(_mm_and_pd(mask.v, a.v), _mm_andnot_pd(mask.v, b.v))};
+    }
+
+    // Bit i is set if lane i of the mask is.
+    inline unsigned bits(Mask mask) { return _mm_movemask_pd(mask.v); }
+
+#else
+
+    unsigned const WIDTH = 1;
+
+    struct Lanes { double v; };
+    struct Mask  { bool v; };
+
+    inline Lanes load(double const *src)  { return {*src}; }
+    inline void store(double *dst, Lanes a) { *dst = a.v; }
+    inline Lanes broadcast(double value)  { return {value}; }
+
+    inline Lanes operator+(Lanes a, Lanes b) { return {a.v + b.v}; }
+    inline Lanes operator-(Lanes a, Lanes b) { return {a.v - b.v}; }
+    inline Lanes operator*(Lanes a, Lanes b) { return {a.v * b.v}; }
+    inline Lanes operator/(Lanes a, Lanes b) { return {a.v / b.v}; }
+    inline Lanes operator-(Lanes a) { return {-a.v}; }
+    inline Lanes sqrt(Lanes a) { return {std::sqrt(a.v)}; }
+    inline Lanes abs(Lanes a)  { return {std::abs(a.v)}; }
+
+    inline Mask operator<(Lanes a, Lanes b)  { return {a.v < b.v}; }
+    inline Mask operator<=(Lanes a, Lanes b) { return {a.v <= b.v}; }
+    inline Mask operator>(Lanes a, Lanes b)  { return {a.v > b.v}; }
+    inline Mask operator==(Lanes a, Lanes b) { return {a.v == b.v}; }
+    inline Mask isnan(Lanes a) { return {std::isnan(a.v)}; }
+
+    inline Mask operator&(Mask a, Mask b) { return {a.v and b.v}; }
+    inline Mask operator|(Mask a, Mask b) { return {a.v or b.v}; }
+    inline Mask operator!(Mask a) { return {not a.v}; }
+
+    inline Lanes select(Mask mask, Lanes a, Lanes b)
+    {
+        return mask.v ? a : b;
+    }
+
+    inline unsigned bits(Mask mask) { return mask.v; }
+
+#endif
+
+    // The same as std::min and std::max: (b < a) ? b : a and (a < b) ? b : a
+    inline Lanes min(Lanes a, Lanes b) { return select(b < a, b, a); }
+    inline Lanes max(Lanes a, Lanes b) { return select(a < b, b, a); }
+
+    // The same as std::fmin and std::fmax: a NaN argument is ignored.
+    inline Lanes fmin(Lanes a, Lanes b)
+    {
+        return select(isnan(a), b, select(b < a, b, a));
+    }
+    inline Lanes fmax(Lanes a, Lanes b)
+    {
+        return select(isnan(a), b, select(a < b, b, a));
+    }
+}
+
+#endif
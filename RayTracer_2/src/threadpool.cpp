@@ -0,0 +1,142 @@
+#include "threadpool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned numThreads)
+{
+    if (numThreads == 0)
+        numThreads = hardwareThreads();
+
+    for (unsigned idx = 0; idx != numThreads; ++idx)
+        d_queues.push_back(unique_ptr<Queue>(new Queue));
+
+    // A single thread works on the caller's thread, no workers needed.
+    if (numThreads > 1)
+        for (unsigned idx = 0; idx != numThreads; ++idx)
+            d_threads.push_back(thread(&ThreadPool::workerLoop, this, idx));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(d_mutex);
+        d_stop = true;
+    }
+    d_start.notify_all();
+
+    for (thread &worker : d_threads)
+        worker.join();
+}
+
+unsigned ThreadPool::size() const
+{
+    return d_queues.size();
+}
+
+unsigned ThreadPool::hardwareThreads()
+{
+    unsigned count = thread::hardware_concurrency();
+    return count == 0 ? 1 : count;
+}
+
+void ThreadPool::parallelFor(unsigned count, Task const &task)
+{
+    if (d_threads.empty())
+    {
+        for (unsigned idx = 0; idx != count; ++idx)
+            task(idx, 0);
+        return;
+    }
+
+    // Deal out contiguous ranges of tasks.
+    unsigned numQueues = d_queues.size();
+    for (unsigned queue = 0; queue != numQueues; ++queue)
+    {
+        unsigned first = static_cast<unsigned long long>(count) * queue / numQueues;
+        unsigned last = static_cast<unsigned long long>(count) * (queue + 1) / numQueues;
+        lock_guard<mutex> lock(d_queues[queue]->mutex);
+        for (unsigned idx = first; idx != last; ++idx)
+            d_queues[queue]->tasks.push_back(idx);
+    }
+
+    unique_lock<mutex> lock(d_mutex);
+    d_task = &task;
+    d_busy = d_threads.size();
+    ++d_generation;
+    d_start.notify_all();
+
+    d_done.wait(lock, [this]{ return d_busy == 0; });
+    d_task = nullptr;
+}
+
+void ThreadPool::workerLoop(unsigned thread)
+{
+    unsigned generation = 0;
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(d_mutex);
+            d_start.wait(lock, [&]{ return d_stop or d_generation != generation; });
+            if (d_stop)
+                return;
+            generation = d_generation;
+        }
+
+        runTasks(thread);
+
+        lock_guard<mutex> lock(d_mutex);
+        if (--d_busy == 0)
+            d_done.notify_one();
+    }
+}
+
+void ThreadPool::runTasks(unsigned thread)
+{
+    unsigned task;
+    while (nextTask(thread, task))
+        (*d_task)(task, thread);
+}
+
+bool ThreadPool::nextTask(unsigned thread, unsigned &task)
+{
+    // Own queue first, in order.
+    {
+        Queue &own = *d_queues[thread];
+        lock_guard<mutex> lock(own.mutex);
+        if (not own.tasks.empty())
+        {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    // Steal from the back of the queue with the most work left. Retry when
+    // the victim ran dry before it could be locked again.
+    while (true)
+    {
+        unsigned victim = thread;
+        size_t most = 0;
+        for (unsigned idx = 0; idx != d_queues.size(); ++idx)
+        {
+            lock_guard<mutex> lock(d_queues[idx]->mutex);
+            if (d_queues[idx]->tasks.size() > most)
+            {
+                most = d_queues[idx]->tasks.size();
+                victim = idx;
+            }
+        }
+
+        if (most == 0)
+            return false;
+
+        Queue &other = *d_queues[victim];
+        lock_guard<mutex> lock(other.mutex);
+        if (not other.tasks.empty())
+        {
+            task = other.tasks.back();
+            other.tasks.pop_back();
+            return true;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads with work stealing.
+//
+// parallelFor hands every worker a contiguous share of the task indices.
+// A worker takes tasks from the front of its own queue; once it runs dry it
+// steals from the back of the fullest other queue. Neighbouring tasks thus
+// mostly end up on the same thread, while load stays balanced.
+class ThreadPool
+{
+    typedef std::function<void(unsigned task, unsigned thread)> Task;
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<unsigned> tasks;
+    };
+
+    std::vector<std::thread> d_threads;
+    std::vector<std::unique_ptr<Queue>> d_queues;
+
+    std::mutex d_mutex;
+    std::condition_variable d_start;
+    std::condition_variable d_done;
+    Task const *d_task = nullptr;   // the job being run, if any
+    unsigned d_generation = 0;      // incremented for every job
+    unsigned d_busy = 0;            // workers still working on the job
+    bool d_stop = false;
+
+    public:
+        // numThreads == 0 selects the number of hardware threads
+        explicit ThreadPool(unsigned numThreads = 0);
+        ~ThreadPool();
+
+        ThreadPool(ThreadPool const &) = delete;
+        ThreadPool &operator=(ThreadPool const &) = delete;
+
+        unsigned size() const;
+
+        // Call task(idx, thread) for every idx in [0, count) and wait until
+        // all calls returned. thread identifies the worker, in [0, size()).
+        // With a single thread the tasks run in order on the calling thread.
+        void parallelFor(unsigned count, Task const &task);
+
+        static unsigned hardwareThreads();
+
+    private:
+        void workerLoop(unsigned thread);
+        void runTasks(unsigned thread);
+        bool nextTask(unsigned thread, unsigned &task);
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "tiles.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace
+{
+    // Position of (x, y) along the Hilbert curve filling an n x n grid,
+    // n being a power of two.
+    unsigned long long hilbertIndex(unsigned n, unsigned x, unsigned y)
+    {
+        unsigned long long d = 0;
+        for (unsigned s = n / 2; s > 0; s /= 2)
+        {
+            unsigned rx = (x & s) > 0;
+            unsigned ry = (y & s) > 0;
+            d += static_cast<unsigned long long>(s) * s * ((3 * rx) ^ ry);
+
+            // Rotate the quadrant so the sub-curve connects.
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                swap(x, y);
+            }
+        }
+        return d;
+    }
+}
+
+vector<Tile> makeTiles(unsigned width, unsigned height, unsigned tileSize)
+{
+    return makeTiles(Tile{0, 0, width, height}, tileSize);
+}
+
+vector<Tile> makeTiles(Tile const &window, unsigned tileSize)
+{
+    if (tileSize == 0)
+        tileSize = 1;
+
+    // The first tile of the window, and the number of them
+    unsigned firstX = window.x0 / tileSize;
+    unsigned firstY = window.y0 / tileSize;
+    unsigned tilesX = (window.x1 + tileSize - 1) / tileSize - firstX;
+    unsigned tilesY = (window.y1 + tileSize - 1) / tileSize - firstY;
+
+    unsigned n = 1;
+    while (n < tilesX or n < tilesY)
+        n *= 2;
+
+    vector<pair<unsigned long long, Tile>> ordered;
+    ordered.reserve(tilesX * tilesY);
+    for (unsigned ty = 0; ty != tilesY; ++ty)
+        for (unsigned tx = 0; tx != tilesX; ++tx)
+        {
+            Tile tile;
+            tile.x0 = max(window.x0, (firstX + tx) * tileSize);
+            tile.y0 = max(window.y0, (firstY + ty) * tileSize);
+            tile.x1 = min(window.x1, (firstX + tx + 1) * tileSize);
+            tile.y1 = min(window.y1, (firstY + ty + 1) * tileSize);
+            ordered.push_back(make_pair(hilbertIndex(n, tx, ty), tile));
+        }
+
+    sort(ordered.begin(), ordered.end(),
+         [](pair<unsigned long long, Tile> const &lhs,
+            pair<unsigned long long, Tile> const &rhs)
+         {
+             return lhs.first < rhs.first;
+         });
+
+    vector<Tile> tiles;
+    tiles.reserve(ordered.size());
+    for (auto const &entry : ordered)
+        tiles.push_back(entry.second);
+    return tiles;
+}
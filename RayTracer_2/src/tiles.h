@@ -0,0 +1,25 @@
+
+#ifndef TILES_H_
+#define TILES_H_
+
+#include <vector>
+
+// Rectangular block of pixels [x0, x1) x [y0, y1).
+struct Tile
+{
+    unsigned x0;
+    unsigned y0;
+    unsigned x1;
+    unsigned y1;
+};
+
+// Split a width x height image into tiles of (at most) tileSize x tileSize
+// pixels. The tiles are ordered along a Hilbert curve, so tiles that are
+// close in the list are close in the image as well.
+std::vector<Tile> makeTiles(unsigned width, unsigned height, unsigned tileSize);
+
+// The same for the pixels of window only: the tiles of the whole image
+// that overlap it, cut to the window.
+std::vector<Tile> makeTiles(Tile const &window, unsigned tileSize);
+
+#endif
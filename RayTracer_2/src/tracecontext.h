@@ -0,0 +1,44 @@
+
+#ifndef TRACECONTEXT_H_
+#define TRACECONTEXT_H_
+
+#include "object.h"
+
+#include <vector>
+
+// Counters of a render, summed over all threads.
+struct RenderStats
+{
+    unsigned long long primaryRays = 0;
+    unsigned long long shadowRays = 0;
+    unsigned long long occluderHits = 0;    // shadow rays blocked by the
+                                            // cached occluder of their light
+    unsigned long long refinedPixels = 0;   // by adaptive supersampling
+
+    RenderStats &operator+=(RenderStats const &other)
+    {
+        primaryRays += other.primaryRays;
+        shadowRays += other.shadowRays;
+        occluderHits += other.occluderHits;
+        refinedPixels += other.refinedPixels;
+        return *this;
+    }
+};
+
+// State of one render thread, handed down the tracing functions of the
+// Scene. Nothing in it affects the image.
+struct TraceContext
+{
+    // Per light the object that blocked the last shadow ray towards it.
+    // Neighbouring shadow rays are likely blocked by the same object, so
+    // it is tested first.
+    std::vector<Object const *> occluders;
+    RenderStats stats;
+
+    explicit TraceContext(unsigned numLights)
+    :
+        occluders(numLights, nullptr)
+    {}
+};
+
+#endif